@@ -1,25 +1,48 @@
 #include "avatardownloader.h"
 
 #include <QImage>
+#include <QImageReader>
 #include <QPainter>
 #include <QBrush>
 #include <QCoreApplication>
+#include "strippedimageprovider.h"
+#include "diskcachemanager.h"
+#include "tracer.h"
+#include "tlschema.h"
+
+#define PHOTO_DISPLAY_SIZE 280
 
 AvatarDownloader::AvatarDownloader(QObject *parent)
     : QObject(parent)
+    , MemoryReporter("AvatarDownloader")
     , _mutex(QMutex::Recursive)
     , _client(0)
     , _userId(0)
     , _requestsAvatars()
     , _requestsPhotos()
+    , _requestsFullPhotos()
     , _downloadedAvatars()
     , _downloadedPhotos()
+    , _photoDisplaySize(PHOTO_DISPLAY_SIZE)
+    , _databaseLoaded(false)
+    , _touched()
+{
+}
+
+TgList AvatarDownloader::memoryUsage() const
 {
+    qint64 requests = _requestsAvatars.size() + _requestsPhotos.size() + _requestsFullPhotos.size();
+
+    TgList usage;
+    usage << MemoryStats::usage("downloadedAvatars", _downloadedAvatars.size(), MemoryStats::variantSize(_downloadedAvatars));
+    usage << MemoryStats::usage("downloadedPhotos", _downloadedPhotos.size(), MemoryStats::variantSize(_downloadedPhotos));
+    usage << MemoryStats::usage("requests", requests, requests * (sizeof(QVariant) + sizeof(qint64)));
+    return usage;
 }
 
 void AvatarDownloader::saveDatabase()
 {
-    if (!_client) {
+    if (!_client || !_databaseLoaded) {
         return;
     }
 
@@ -49,22 +72,40 @@ void AvatarDownloader::setClient(QObject *client)
     }
 
     _client = dynamic_cast<TgClient*>(client);
-    _userId = _client->getUserId();
 
     _requestsAvatars.clear();
     _requestsPhotos.clear();
-    readDatabase();
+    _requestsFullPhotos.clear();
+    _downloadedAvatars.clear();
+    _downloadedPhotos.clear();
+    _touched.clear();
+    _databaseLoaded = false;
 
     if (!_client) return;
 
-    _client->sessionDirectory().mkdir("Kutegram_avatars");
-    _client->sessionDirectory().mkdir("Kutegram_photos");
+    _userId = _client->getUserId();
 
+    //Cache index is read by loadDatabase() after the first frame, or on first use
     connect(_client, SIGNAL(authorized(TgLongVariant)), this, SLOT(authorized(TgLongVariant)));
     connect(_client, SIGNAL(fileDownloaded(TgLongVariant,QString)), this, SLOT(fileDownloaded(TgLongVariant,QString)));
     connect(_client, SIGNAL(fileDownloadCanceled(TgLongVariant,QString)), this, SLOT(fileDownloadCanceled(TgLongVariant,QString)));
 }
 
+void AvatarDownloader::loadDatabase()
+{
+    QMutexLocker lock(&_mutex);
+
+    if (!_client || _databaseLoaded) {
+        return;
+    }
+
+    readDatabase();
+    _databaseLoaded = true;
+
+    _client->sessionDirectory().mkdir("Kutegram_avatars");
+    _client->sessionDirectory().mkdir("Kutegram_photos");
+}
+
 void AvatarDownloader::authorized(TgLongVariant userId)
 {
     QMutexLocker lock(&_mutex);
@@ -72,6 +113,7 @@ void AvatarDownloader::authorized(TgLongVariant userId)
     if (_userId != userId) {
         _requestsAvatars.clear();
         _requestsPhotos.clear();
+        _requestsFullPhotos.clear();
         _userId = userId;
     }
 }
@@ -81,9 +123,62 @@ QObject* AvatarDownloader::client() const
     return _client;
 }
 
+void AvatarDownloader::setPhotoDisplaySize(qint32 size)
+{
+    _photoDisplaySize = size > 0 ? size : PHOTO_DISPLAY_SIZE;
+}
+
+qint32 AvatarDownloader::photoDisplaySize() const
+{
+    return _photoDisplaySize;
+}
+
+TgObject AvatarDownloader::photoSize(TgObject photo, qint32 displaySize)
+{
+    //Smallest downloadable size covering the display size, or the largest one if none does.
+    //displaySize 0 means the largest one.
+    TgList sizes = photo["sizes"].toList();
+    TgObject best;
+    qint32 bestSide = 0;
+
+    for (qint32 i = 0; i < sizes.size(); ++i) {
+        TgObject size = sizes[i].toMap();
+        if (ID(size) != TLType::PhotoSize && ID(size) != TLType::PhotoSizeProgressive) {
+            continue;
+        }
+
+        qint32 side = qMax(size["w"].toInt(), size["h"].toInt());
+        bool covers = displaySize > 0 && side >= displaySize;
+        bool bestCovers = displaySize > 0 && bestSide >= displaySize;
+
+        if (bestSide == 0
+                || (covers && (!bestCovers || side < bestSide))
+                || (!covers && !bestCovers && side > bestSide)) {
+            best = size;
+            bestSide = side;
+        }
+    }
+
+    return best;
+}
+
+QImage AvatarDownloader::readScaled(QString filePath, qint32 displaySize)
+{
+    //Let the decoder downscale (JPEG does it during DCT), instead of decoding full size and scaling
+    QImageReader reader(filePath);
+    QSize size = reader.size();
+
+    if (size.isValid() && qMax(size.width(), size.height()) > displaySize) {
+        reader.setScaledSize(size.scaled(displaySize, displaySize, Qt::KeepAspectRatio));
+    }
+
+    return reader.read();
+}
+
 qint64 AvatarDownloader::downloadPhoto(TgObject photo)
 {
     QMutexLocker lock(&_mutex);
+    loadDatabase();
 
     if (!_client || !_client->isAuthorized() || GETID(photo) == 0) {
         return 0;
@@ -94,23 +189,66 @@ qint64 AvatarDownloader::downloadPhoto(TgObject photo)
     QString relativePath = "Kutegram_photos/" + QString::number(photoId) + ".jpg";
     QString avatarFilePath = _client->sessionDirectory().absoluteFilePath(relativePath);
 
-    if (!_downloadedPhotos.contains(photoId)) {
+    if (!_downloadedPhotos.contains(photoId) || !touchCached(_downloadedPhotos, photoId, avatarFilePath + ".thumbnail.jpg")) {
+        //Only offer the right size to the client, so it does not fetch the original
+        TgObject size = photoSize(photo, _photoDisplaySize);
+        if (!size.isEmpty()) {
+            photo["sizes"] = TgList() << size;
+        }
+
         qint64 loadingId = _client->downloadFile(avatarFilePath, photo).toLongLong();
+        TRACE_REQUEST_ISSUED("upload.getFile", loadingId);
         _requestsPhotos[loadingId] = photoId;
     } else {
 #if QT_VERSION >= 0x050000
-        emit photoDownloaded(photoId, "file:///" + avatarFilePath);
+        emit photoDownloaded(photoId, "file:///" + avatarFilePath + ".thumbnail.jpg");
 #else
-        emit photoDownloaded(photoId, avatarFilePath);
+        emit photoDownloaded(photoId, avatarFilePath + ".thumbnail.jpg");
 #endif
     }
 
     return photoId;
 }
 
+qint64 AvatarDownloader::downloadFullPhoto(TgObject photo)
+{
+    QMutexLocker lock(&_mutex);
+    loadDatabase();
+
+    if (!_client || !_client->isAuthorized() || GETID(photo) == 0) {
+        return 0;
+    }
+
+    qint64 photoId = photo["id"].toLongLong();
+
+    QString relativePath = "Kutegram_photos/" + QString::number(photoId) + ".full.jpg";
+    QString photoFilePath = _client->sessionDirectory().absoluteFilePath(relativePath);
+
+    if (DiskCacheManager::touch(photoFilePath)) {
+#if QT_VERSION >= 0x050000
+        emit fullPhotoDownloaded(photoId, "file:///" + photoFilePath);
+#else
+        emit fullPhotoDownloaded(photoId, photoFilePath);
+#endif
+        return photoId;
+    }
+
+    TgObject size = photoSize(photo, 0);
+    if (!size.isEmpty()) {
+        photo["sizes"] = TgList() << size;
+    }
+
+    qint64 loadingId = _client->downloadFile(photoFilePath, photo).toLongLong();
+    TRACE_REQUEST_ISSUED("upload.getFile", loadingId);
+    _requestsFullPhotos[loadingId] = photoId;
+
+    return photoId;
+}
+
 qint64 AvatarDownloader::downloadAvatar(TgObject peer)
 {
     QMutexLocker lock(&_mutex);
+    loadDatabase();
 
     if (!_client || !_client->isAuthorized() || TgClient::commonPeerType(peer) == 0) {
         return 0;
@@ -126,8 +264,9 @@ qint64 AvatarDownloader::downloadAvatar(TgObject peer)
     QString relativePath = "Kutegram_avatars/" + QString::number(photoId) + ".jpg";
     QString avatarFilePath = _client->sessionDirectory().absoluteFilePath(relativePath);
 
-    if (!_downloadedAvatars.contains(photoId)) {
+    if (!_downloadedAvatars.contains(photoId) || !touchCached(_downloadedAvatars, photoId, avatarFilePath + ".png")) {
         qint64 loadingId = _client->downloadFile(avatarFilePath, peer).toLongLong();
+        TRACE_REQUEST_ISSUED("upload.getFile", loadingId);
         _requestsAvatars[loadingId] = photoId;
     } else {
 #if QT_VERSION >= 0x050000
@@ -142,10 +281,17 @@ qint64 AvatarDownloader::downloadAvatar(TgObject peer)
 
 void AvatarDownloader::fileDownloaded(TgLongVariant fileId, QString filePath)
 {
+    TRACE_SPAN_ARG("AvatarDownloader::fileDownloaded", "fileId", fileId.toLongLong());
     QMutexLocker lock(&_mutex);
+    loadDatabase();
+
+    if (isRequested(fileId.toLongLong())) {
+        TRACE_REQUEST_FINISHED("upload.getFile", fileId.toLongLong());
+    }
 
     TgLongVariant photoId = _requestsAvatars.take(fileId.toLongLong());
     if (!photoId.isNull()) {
+        QString originalPath = filePath;
         QFile file(filePath);
         if (!file.open(QFile::ReadOnly)) {
             return;
@@ -164,8 +310,13 @@ void AvatarDownloader::fileDownloaded(TgLongVariant fileId, QString filePath)
             return;
         }
 
+        //Only the rounded copy is ever shown
+        QFile::remove(originalPath);
+
         _downloadedAvatars.append(photoId);
+        _touched.insert(photoId.toLongLong());
         saveDatabase();
+        StrippedImageProvider::remove("image://stripped/avatar/" + photoId.toString());
 #if QT_VERSION >= 0x050000
         emit avatarDownloaded(photoId, "file:///" + filePath);
 #else
@@ -176,36 +327,114 @@ void AvatarDownloader::fileDownloaded(TgLongVariant fileId, QString filePath)
 
     photoId = _requestsPhotos.take(fileId.toLongLong());
     if (!photoId.isNull()) {
-        QFile file(filePath);
-        if (!file.open(QFile::ReadOnly)) {
+        QImage scaledImage = readScaled(filePath, _photoDisplaySize);
+        if (scaledImage.isNull() || !scaledImage.save(filePath + ".thumbnail.jpg")) {
             return;
         }
 
-        QImage scaledImage = QImage::fromData(file.readAll());
-        if (scaledImage.height() > scaledImage.width()) {
-            scaledImage = scaledImage.scaledToHeight(280, Qt::SmoothTransformation);
-        } else {
-            scaledImage = scaledImage.scaledToWidth(280, Qt::SmoothTransformation);
-        }
-        file.close();
-        if (!scaledImage.save(filePath + ".thumbnail.jpg")) {
-            return;
-        }
+        //Only the thumbnail is ever shown, the full size is a separate download
+        QFile::remove(filePath);
 
         _downloadedPhotos.append(photoId);
+        _touched.insert(photoId.toLongLong());
         saveDatabase();
-        emit photoDownloaded(photoId, "file:///" + filePath);
+        StrippedImageProvider::remove("image://stripped/photo/" + photoId.toString());
+#if QT_VERSION >= 0x050000
+        emit photoDownloaded(photoId, "file:///" + filePath + ".thumbnail.jpg");
+#else
+        emit photoDownloaded(photoId, filePath + ".thumbnail.jpg");
+#endif
+        return;
+    }
+
+    photoId = _requestsFullPhotos.take(fileId.toLongLong());
+    if (!photoId.isNull()) {
+#if QT_VERSION >= 0x050000
+        emit fullPhotoDownloaded(photoId, "file:///" + filePath);
+#else
+        emit fullPhotoDownloaded(photoId, filePath);
+#endif
         return;
     }
 }
 
+bool AvatarDownloader::touchCached(TgList &downloaded, qint64 photoId, QString filePath)
+{
+    if (_touched.contains(photoId)) {
+        return true;
+    }
+
+    //Gone from disk, it is downloaded again
+    if (!DiskCacheManager::touch(filePath)) {
+        downloaded.removeAll(photoId);
+        saveDatabase();
+        return false;
+    }
+
+    _touched.insert(photoId);
+    return true;
+}
+
+QSet<qint64> AvatarDownloader::servedIds()
+{
+    QMutexLocker lock(&_mutex);
+    return _touched;
+}
+
+void AvatarDownloader::forget(TgList avatarIds, TgList photoIds)
+{
+    QMutexLocker lock(&_mutex);
+
+    for (qint32 i = 0; i < avatarIds.size(); ++i) {
+        _downloadedAvatars.removeAll(avatarIds[i]);
+        _touched.remove(avatarIds[i].toLongLong());
+    }
+    for (qint32 i = 0; i < photoIds.size(); ++i) {
+        _downloadedPhotos.removeAll(photoIds[i]);
+        _touched.remove(photoIds[i].toLongLong());
+    }
+
+    saveDatabase();
+}
+
+bool AvatarDownloader::isRequested(qint64 fileId) const
+{
+    return _requestsAvatars.contains(fileId) || _requestsPhotos.contains(fileId) || _requestsFullPhotos.contains(fileId);
+}
+
 void AvatarDownloader::fileDownloadCanceled(TgLongVariant fileId, QString filePath)
 {
     Q_UNUSED(filePath);
     QMutexLocker lock(&_mutex);
 
+    if (isRequested(fileId.toLongLong())) {
+        TRACE_REQUEST_FINISHED("upload.getFile", fileId.toLongLong());
+    }
+
     _requestsAvatars.remove(fileId.toLongLong());
     _requestsPhotos.remove(fileId.toLongLong());
+    _requestsFullPhotos.remove(fileId.toLongLong());
+}
+
+QString AvatarDownloader::avatarPlaceholder(TgObject peer)
+{
+    TgObject photo = peer["photo"].toMap();
+
+    return StrippedImageProvider::addAvatar(photo["photo_id"].toLongLong(), photo["stripped_thumb"].toByteArray());
+}
+
+QString AvatarDownloader::photoPlaceholder(TgObject photo)
+{
+    TgList sizes = photo["sizes"].toList();
+
+    for (qint32 i = 0; i < sizes.size(); ++i) {
+        TgObject size = sizes[i].toMap();
+        if (ID(size) == TLType::PhotoStrippedSize) {
+            return StrippedImageProvider::addPhoto(photo["id"].toLongLong(), size["bytes"].toByteArray());
+        }
+    }
+
+    return "";
 }
 
 QString AvatarDownloader::getAvatarText(QString title)
@@ -4,14 +4,18 @@
 #include <QObject>
 
 #include <QMutex>
+#include <QSet>
 #include <QColor>
 #include <QSettings>
+#include <QImage>
 #include "tgclient.h"
+#include "memorystats.h"
 
-class AvatarDownloader : public QObject
+class AvatarDownloader : public QObject, public MemoryReporter
 {
     Q_OBJECT
     Q_PROPERTY(QObject* client READ client WRITE setClient)
+    Q_PROPERTY(qint32 photoDisplaySize READ photoDisplaySize WRITE setPhotoDisplaySize)
 
 private:
     QMutex _mutex;
@@ -19,8 +23,16 @@ private:
     TgLongVariant _userId;
     QHash<qint64, TgLongVariant> _requestsAvatars;
     QHash<qint64, TgLongVariant> _requestsPhotos;
+    QHash<qint64, TgLongVariant> _requestsFullPhotos;
     TgList _downloadedAvatars;
     TgList _downloadedPhotos;
+    qint32 _photoDisplaySize;
+    bool _databaseLoaded;
+    //Cached files already served this session, see DiskCacheManager::touch()
+    QSet<qint64> _touched;
+
+    bool isRequested(qint64 fileId) const;
+    bool touchCached(TgList &downloaded, qint64 photoId, QString filePath);
 
 public:
     explicit AvatarDownloader(QObject *parent = 0);
@@ -30,17 +42,37 @@ public:
     void setClient(QObject *client);
     QObject* client() const;
 
+    void setPhotoDisplaySize(qint32 size);
+    qint32 photoDisplaySize() const;
+
+    TgList memoryUsage() const;
+
+    //Avatars and photos handed out this session, their files must stay on disk
+    QSet<qint64> servedIds();
+
+    static TgObject photoSize(TgObject photo, qint32 displaySize);
+    static QImage readScaled(QString filePath, qint32 displaySize);
+
 signals:
     void avatarDownloaded(TgLongVariant photoId, QString filePath);
     void photoDownloaded(TgLongVariant photoId, QString filePath);
+    void fullPhotoDownloaded(TgLongVariant photoId, QString filePath);
 
 public slots:
+    void loadDatabase();
     void authorized(TgLongVariant userId);
     void fileDownloaded(TgLongVariant fileId, QString filePath);
     void fileDownloadCanceled(TgLongVariant fileId, QString filePath);
 
     qint64 downloadAvatar(TgObject peer);
     qint64 downloadPhoto(TgObject photo);
+    qint64 downloadFullPhoto(TgObject photo);
+
+    //Drops files evicted by DiskCacheManager from the download index
+    void forget(TgList avatarIds, TgList photoIds);
+
+    static QString avatarPlaceholder(TgObject peer);
+    static QString photoPlaceholder(TgObject photo);
 
     static QString getAvatarText(QString title);
     static QColor userColor(TgLongVariant id);
@@ -0,0 +1,147 @@
+#include "cachetrimmer.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QStringList>
+#include <QVariantMap>
+#include <algorithm>
+
+CacheTrimmer::CacheTrimmer(QString directory, QHash<QString, qint64> budgets, QSet<qint64> pinned, qint64 gracePeriod)
+    : QObject()
+    , QRunnable()
+    , m_directory(directory)
+    , m_budgets(budgets)
+    , m_pinned(pinned)
+    , m_gracePeriod(gracePeriod)
+{
+    //Deleted on the GUI thread, see run()
+    setAutoDelete(false);
+}
+
+QString CacheTrimmer::category(QString directory, QString fileName, qint64 *photoId)
+{
+    bool ok = false;
+    *photoId = fileName.section('.', 0, 0).toLongLong(&ok);
+    if (!ok) {
+        return QString();
+    }
+
+    if (directory == "Kutegram_avatars") {
+        return "avatars";
+    }
+
+    if (directory == "Kutegram_photos") {
+        return fileName.endsWith(".full.jpg") ? "fullPhotos" : "photos";
+    }
+
+    return QString();
+}
+
+struct CacheEntry {
+    qint64 photoId;
+    qint64 lastAccess;
+    qint64 size;
+    QStringList files;
+};
+
+static bool olderAccess(const CacheEntry &a, const CacheEntry &b)
+{
+    return a.lastAccess < b.lastAccess;
+}
+
+void CacheTrimmer::run()
+{
+    QHash<QString, QHash<qint64, CacheEntry> > entries;
+    QHash<QString, qint64> used;
+
+    QStringList directories;
+    directories << "Kutegram_avatars" << "Kutegram_photos";
+
+    for (qint32 i = 0; i < directories.size(); ++i) {
+        QFileInfoList files = QDir(m_directory + "/" + directories[i]).entryInfoList(QDir::Files | QDir::NoDotAndDotDot);
+
+        for (qint32 j = 0; j < files.size(); ++j) {
+            const QFileInfo &file = files[j];
+
+            qint64 photoId;
+            QString category = CacheTrimmer::category(directories[i], file.fileName(), &photoId);
+            if (category.isEmpty()) {
+                continue;
+            }
+
+            CacheEntry &entry = entries[category][photoId];
+            if (entry.files.isEmpty()) {
+                entry.photoId = photoId;
+                entry.lastAccess = 0;
+                entry.size = 0;
+            }
+
+            entry.lastAccess = qMax(entry.lastAccess, file.lastModified().toMSecsSinceEpoch());
+            entry.size += file.size();
+            entry.files << file.absoluteFilePath();
+            used[category] += file.size();
+        }
+    }
+
+    //Files touched just now may still be written or shown
+    qint64 keepAfter = QDateTime::currentMSecsSinceEpoch() - m_gracePeriod;
+    qint64 freed = 0;
+    QVariantMap evicted;
+    QVariantMap usage;
+
+    QStringList categories = entries.keys();
+    for (qint32 i = 0; i < categories.size(); ++i) {
+        QString category = categories[i];
+        qint64 budget = m_budgets.value(category, -1);
+
+        if (budget >= 0 && used[category] > budget) {
+            QList<CacheEntry> ordered = entries[category].values();
+            std::sort(ordered.begin(), ordered.end(), olderAccess);
+
+            QVariantList ids;
+            for (qint32 j = 0; j < ordered.size() && used[category] > budget; ++j) {
+                const CacheEntry &entry = ordered[j];
+                if (entry.lastAccess > keepAfter) {
+                    break;
+                }
+
+                //Counted against the budget, but still shown by model rows
+                if (m_pinned.contains(entry.photoId)) {
+                    continue;
+                }
+
+                //Served again while the directories were scanned
+                bool touched = false;
+                for (qint32 k = 0; k < entry.files.size() && !touched; ++k) {
+                    touched = QFileInfo(entry.files[k]).lastModified().toMSecsSinceEpoch() > keepAfter;
+                }
+                if (touched) {
+                    continue;
+                }
+
+                for (qint32 k = 0; k < entry.files.size(); ++k) {
+                    QFile::remove(entry.files[k]);
+                }
+
+                used[category] -= entry.size;
+                freed += entry.size;
+                ids << entry.photoId;
+            }
+
+            evicted[category] = ids;
+        }
+
+        usage[category] = used[category];
+    }
+
+    QVariantMap result;
+    result["evicted"] = evicted;
+    result["usage"] = usage;
+    result["freed"] = freed;
+
+    //Queued to the GUI thread, a receiver destroyed meanwhile is disconnected already
+    emit trimmed(result);
+    deleteLater();
+}
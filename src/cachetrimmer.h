@@ -0,0 +1,41 @@
+#ifndef CACHETRIMMER_H
+#define CACHETRIMMER_H
+
+#include <QRunnable>
+#include <QObject>
+#include <QHash>
+#include <QSet>
+#include <QString>
+#include <QVariantMap>
+
+//Scans the avatar and photo cache directories on a QThreadPool thread and
+//removes the least recently used files of every category that exceeds its byte
+//budget. All files of one photo (original, rounded avatar, thumbnail) form one
+//entry, its last access is the newest mtime among them, see DiskCacheManager::touch().
+//Photos in pinned are still referenced by model rows, they count against the
+//budget but are never removed.
+//The trimmer is created on the GUI thread and stays there, trimmed() is queued
+//to the receivers and the trimmer deletes itself afterwards.
+class CacheTrimmer : public QObject, public QRunnable
+{
+    Q_OBJECT
+
+public:
+    CacheTrimmer(QString directory, QHash<QString, qint64> budgets, QSet<qint64> pinned, qint64 gracePeriod);
+
+    void run();
+
+    //Cache category of a file and the photo id it belongs to, empty for foreign files
+    static QString category(QString directory, QString fileName, qint64 *photoId);
+
+signals:
+    void trimmed(QVariantMap result);
+
+private:
+    QString m_directory;
+    QHash<QString, qint64> m_budgets;
+    QSet<qint64> m_pinned;
+    qint64 m_gracePeriod;
+};
+
+#endif // CACHETRIMMER_H
@@ -0,0 +1,136 @@
+#include "diskcachemanager.h"
+
+#include <QFile>
+#include <QThreadPool>
+#include <utime.h>
+#include "cachetrimmer.h"
+#include "tracer.h"
+
+#define DEFAULT_AVATARS_BUDGET (8 * 1024 * 1024)
+#define DEFAULT_PHOTOS_BUDGET (64 * 1024 * 1024)
+#define DEFAULT_FULL_PHOTOS_BUDGET (128 * 1024 * 1024)
+//Files used within this period are never evicted
+#define GRACE_PERIOD 60000
+
+DiskCacheManager::DiskCacheManager(QObject *parent)
+    : QObject(parent)
+    , m_client(nullptr)
+    , m_avatarDownloader(nullptr)
+    , m_avatarsBudget(DEFAULT_AVATARS_BUDGET)
+    , m_photosBudget(DEFAULT_PHOTOS_BUDGET)
+    , m_fullPhotosBudget(DEFAULT_FULL_PHOTOS_BUDGET)
+    , m_trimming(false)
+    , m_pending(false)
+{
+}
+
+void DiskCacheManager::setClient(QObject *client)
+{
+    m_client = dynamic_cast<TgClient*>(client);
+}
+
+QObject* DiskCacheManager::client() const
+{
+    return m_client;
+}
+
+void DiskCacheManager::setAvatarDownloader(QObject *avatarDownloader)
+{
+    m_avatarDownloader = dynamic_cast<AvatarDownloader*>(avatarDownloader);
+}
+
+QObject* DiskCacheManager::avatarDownloader() const
+{
+    return m_avatarDownloader;
+}
+
+void DiskCacheManager::setAvatarsBudget(qint64 bytes)
+{
+    m_avatarsBudget = bytes;
+}
+
+qint64 DiskCacheManager::avatarsBudget() const
+{
+    return m_avatarsBudget;
+}
+
+void DiskCacheManager::setPhotosBudget(qint64 bytes)
+{
+    m_photosBudget = bytes;
+}
+
+qint64 DiskCacheManager::photosBudget() const
+{
+    return m_photosBudget;
+}
+
+void DiskCacheManager::setFullPhotosBudget(qint64 bytes)
+{
+    m_fullPhotosBudget = bytes;
+}
+
+qint64 DiskCacheManager::fullPhotosBudget() const
+{
+    return m_fullPhotosBudget;
+}
+
+bool DiskCacheManager::trimming() const
+{
+    return m_trimming;
+}
+
+bool DiskCacheManager::touch(QString filePath)
+{
+    //atime is not reliable (noatime/relatime mounts), so last access is kept in mtime
+    return utime(QFile::encodeName(filePath).constData(), 0) == 0;
+}
+
+void DiskCacheManager::trim()
+{
+    if (!m_client) {
+        return;
+    }
+
+    //One scan at a time, a request meanwhile runs once it is done
+    if (m_trimming) {
+        m_pending = true;
+        return;
+    }
+
+    QHash<QString, qint64> budgets;
+    budgets.insert("avatars", m_avatarsBudget);
+    budgets.insert("photos", m_photosBudget);
+    budgets.insert("fullPhotos", m_fullPhotosBudget);
+
+    m_trimming = true;
+    m_pending = false;
+    emit trimmingChanged();
+
+    //Rows keep the paths of everything served this session
+    QSet<qint64> pinned;
+    if (m_avatarDownloader) {
+        pinned = m_avatarDownloader->servedIds();
+    }
+
+    CacheTrimmer* trimmer = new CacheTrimmer(m_client->sessionDirectory().absolutePath(), budgets, pinned, GRACE_PERIOD);
+    connect(trimmer, SIGNAL(trimmed(QVariantMap)), this, SLOT(cacheTrimmed(QVariantMap)), Qt::QueuedConnection);
+    QThreadPool::globalInstance()->start(trimmer);
+}
+
+void DiskCacheManager::cacheTrimmed(QVariantMap result)
+{
+    TRACE_SPAN_ARG("DiskCacheManager::cacheTrimmed", "freed", result["freed"].toLongLong());
+
+    QVariantMap evicted = result["evicted"].toMap();
+    if (m_avatarDownloader && !evicted.isEmpty()) {
+        m_avatarDownloader->forget(evicted["avatars"].toList(), evicted["photos"].toList());
+    }
+
+    m_trimming = false;
+    emit trimmingChanged();
+    emit trimmed(result["freed"].toLongLong());
+
+    if (m_pending) {
+        trim();
+    }
+}
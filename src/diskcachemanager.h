@@ -0,0 +1,68 @@
+#ifndef DISKCACHEMANAGER_H
+#define DISKCACHEMANAGER_H
+
+#include <QObject>
+#include <QVariantMap>
+#include "tgclient.h"
+#include "avatardownloader.h"
+
+//Keeps the avatar, photo thumbnail and full photo caches in the session directory
+//within their byte budgets. trim() runs a CacheTrimmer in the background (at
+//startup and when the app goes idle), least recently used photos are evicted
+//first, and AvatarDownloader forgets what was removed. Photos served this session
+//are kept, model rows still show them by path. A budget below 0 disables
+//trimming of that category.
+class DiskCacheManager : public QObject
+{
+    Q_OBJECT
+    Q_PROPERTY(QObject* client READ client WRITE setClient)
+    Q_PROPERTY(QObject* avatarDownloader READ avatarDownloader WRITE setAvatarDownloader)
+    Q_PROPERTY(qint64 avatarsBudget READ avatarsBudget WRITE setAvatarsBudget)
+    Q_PROPERTY(qint64 photosBudget READ photosBudget WRITE setPhotosBudget)
+    Q_PROPERTY(qint64 fullPhotosBudget READ fullPhotosBudget WRITE setFullPhotosBudget)
+    Q_PROPERTY(bool trimming READ trimming NOTIFY trimmingChanged)
+
+public:
+    explicit DiskCacheManager(QObject *parent = 0);
+
+    void setClient(QObject *client);
+    QObject* client() const;
+
+    void setAvatarDownloader(QObject *avatarDownloader);
+    QObject* avatarDownloader() const;
+
+    void setAvatarsBudget(qint64 bytes);
+    qint64 avatarsBudget() const;
+
+    void setPhotosBudget(qint64 bytes);
+    qint64 photosBudget() const;
+
+    void setFullPhotosBudget(qint64 bytes);
+    qint64 fullPhotosBudget() const;
+
+    bool trimming() const;
+
+    //Marks a cached file as used now. false if it is gone (evicted or removed by hand).
+    static bool touch(QString filePath);
+
+signals:
+    void trimmingChanged();
+    void trimmed(qint64 freedBytes);
+
+public slots:
+    void trim();
+    void cacheTrimmed(QVariantMap result);
+
+private:
+    TgClient* m_client;
+    AvatarDownloader* m_avatarDownloader;
+
+    qint64 m_avatarsBudget;
+    qint64 m_photosBudget;
+    qint64 m_fullPhotosBudget;
+
+    bool m_trimming;
+    bool m_pending;
+};
+
+#endif // DISKCACHEMANAGER_H
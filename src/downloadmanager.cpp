@@ -0,0 +1,357 @@
+#include "downloadmanager.h"
+
+#include <QCoreApplication>
+#include <QSettings>
+#include <QFile>
+#include <QFileInfo>
+#include "tracer.h"
+
+#define DEFAULT_MAX_CONCURRENT 2
+
+DownloadManager::DownloadManager(QObject *parent)
+    : QObject(parent)
+    , MemoryReporter("DownloadManager")
+    , _mutex(QMutex::Recursive)
+    , _client(0)
+    , _userId(0)
+    , _maxConcurrent(DEFAULT_MAX_CONCURRENT)
+    , _lastId(0)
+    , _databaseLoaded(false)
+    , _downloads()
+    , _queue()
+    , _requests()
+    , _messages()
+{
+}
+
+TgList DownloadManager::memoryUsage() const
+{
+    qint64 bytes = 0;
+    for (QHash<qint64, Download>::const_iterator i = _downloads.constBegin(); i != _downloads.constEnd(); ++i) {
+        bytes += sizeof(Download) + MemoryStats::objectSize(i.value().input) + i.value().filePath.size() * sizeof(QChar);
+    }
+
+    TgList usage;
+    usage << MemoryStats::usage("downloads", _downloads.size(), bytes);
+    return usage;
+}
+
+void DownloadManager::saveDatabase()
+{
+    if (!_client || !_databaseLoaded) {
+        return;
+    }
+
+    TgList downloads;
+    for (qint32 i = 0; i < _queue.size(); ++i) {
+        Download download = _downloads.value(_queue[i]);
+
+        TgObject entry;
+        entry["peer"] = download.peer;
+        entry["messageId"] = download.messageId;
+        entry["input"] = download.input;
+        entry["filePath"] = download.filePath;
+        entry["received"] = download.received;
+        entry["total"] = download.total;
+        downloads << entry;
+    }
+
+    QSettings settings(QSettings::IniFormat, QSettings::UserScope, QCoreApplication::organizationName(), QCoreApplication::applicationName() + "_cache");
+    settings.setValue("Downloads", downloads);
+}
+
+void DownloadManager::readDatabase()
+{
+    if (!_client) {
+        return;
+    }
+
+    QSettings settings(QSettings::IniFormat, QSettings::UserScope, QCoreApplication::organizationName(), QCoreApplication::applicationName() + "_cache");
+    TgList downloads = settings.value("Downloads").toList();
+
+    for (qint32 i = 0; i < downloads.size(); ++i) {
+        TgObject entry = downloads[i].toMap();
+
+        Download download;
+        download.id = ++_lastId;
+        download.peer = entry["peer"].toLongLong();
+        download.messageId = entry["messageId"].toInt();
+        download.input = entry["input"].toMap();
+        download.filePath = entry["filePath"].toString();
+        download.requestId = 0;
+        download.received = entry["received"].toLongLong();
+        download.total = entry["total"].toLongLong();
+
+        _downloads.insert(download.id, download);
+        _messages.insert(qMakePair(download.peer, download.messageId), download.id);
+        _queue.append(download.id);
+    }
+}
+
+void DownloadManager::setClient(QObject *client)
+{
+    QMutexLocker lock(&_mutex);
+
+    if (_client) {
+        _client->disconnect(this);
+        saveDatabase();
+    }
+
+    _client = dynamic_cast<TgClient*>(client);
+
+    _downloads.clear();
+    _queue.clear();
+    _requests.clear();
+    _messages.clear();
+
+    if (!_client) return;
+
+    _userId = _client->getUserId();
+    _databaseLoaded = false;
+
+    //Queue is read by loadDatabase() after the first frame, or on first use
+    connect(_client, SIGNAL(authorized(TgLongVariant)), this, SLOT(authorized(TgLongVariant)));
+    connect(_client, SIGNAL(fileDownloading(TgLongVariant,TgLongVariant,TgLongVariant,qint32)), this, SLOT(fileDownloading(TgLongVariant,TgLongVariant,TgLongVariant,qint32)));
+    connect(_client, SIGNAL(fileDownloaded(TgLongVariant,QString)), this, SLOT(fileDownloaded(TgLongVariant,QString)));
+    connect(_client, SIGNAL(fileDownloadCanceled(TgLongVariant,QString)), this, SLOT(fileDownloadCanceled(TgLongVariant,QString)));
+
+}
+
+void DownloadManager::loadDatabase()
+{
+    QMutexLocker lock(&_mutex);
+
+    if (!_client || _databaseLoaded) {
+        return;
+    }
+
+    readDatabase();
+    _databaseLoaded = true;
+
+    pump();
+}
+
+QObject* DownloadManager::client() const
+{
+    return _client;
+}
+
+void DownloadManager::setMaxConcurrent(qint32 count)
+{
+    QMutexLocker lock(&_mutex);
+
+    _maxConcurrent = qMax(count, 1);
+    pump();
+}
+
+qint32 DownloadManager::maxConcurrent() const
+{
+    return _maxConcurrent;
+}
+
+QString DownloadManager::partFilePath(QString filePath)
+{
+    return filePath + ".part";
+}
+
+void DownloadManager::authorized(TgLongVariant userId)
+{
+    QMutexLocker lock(&_mutex);
+
+    loadDatabase();
+
+    //Requests of the previous connection are gone, queued order is kept
+    QList<qint64> ids = _downloads.keys();
+    for (qint32 i = 0; i < ids.size(); ++i) {
+        _downloads[ids[i]].requestId = 0;
+    }
+    _requests.clear();
+
+    if (_userId != userId) {
+        _downloads.clear();
+        _queue.clear();
+        _messages.clear();
+        _userId = userId;
+        saveDatabase();
+    }
+
+    pump();
+}
+
+void DownloadManager::pump()
+{
+    if (!_client || !_databaseLoaded || !_client->isAuthorized()) {
+        return;
+    }
+
+    for (qint32 i = 0; i < _queue.size() && _requests.size() < _maxConcurrent; ++i) {
+        Download &download = _downloads[_queue[i]];
+        if (download.requestId == 0) {
+            start(download);
+        }
+    }
+}
+
+void DownloadManager::start(Download &download)
+{
+    //Finished before the app went away, it was just not moved in place
+    QFileInfo part(partFilePath(download.filePath));
+    if (download.total > 0 && part.exists() && part.size() == download.total) {
+        QFile::rename(part.absoluteFilePath(), download.filePath);
+        emit downloadFinished(download.peer, download.messageId, "file:///" + download.filePath);
+        finish(download.id);
+        return;
+    }
+
+    //TgClient::downloadFile has no start offset, an interrupted transfer starts over
+    if (part.exists()) {
+        QFile::remove(part.absoluteFilePath());
+    }
+    download.received = 0;
+
+    download.requestId = _client->downloadFile(partFilePath(download.filePath), download.input).toLongLong();
+    TRACE_REQUEST_ISSUED("upload.getFile", download.requestId);
+    _requests.insert(download.requestId, download.id);
+
+    emit downloadStarted(download.peer, download.messageId);
+}
+
+void DownloadManager::finish(qint64 downloadId)
+{
+    Download download = _downloads.take(downloadId);
+
+    _queue.removeOne(downloadId);
+    _requests.remove(download.requestId);
+    _messages.remove(qMakePair(download.peer, download.messageId));
+
+    saveDatabase();
+}
+
+qint64 DownloadManager::enqueue(qint64 peer, qint32 messageId, TgObject input, QString filePath)
+{
+    QMutexLocker lock(&_mutex);
+
+    if (!_client) {
+        return 0;
+    }
+
+    loadDatabase();
+    cancel(peer, messageId);
+
+    Download download;
+    download.id = ++_lastId;
+    download.peer = peer;
+    download.messageId = messageId;
+    download.input = input;
+    download.filePath = filePath;
+    download.requestId = 0;
+    download.received = 0;
+    download.total = 0;
+
+    _downloads.insert(download.id, download);
+    _messages.insert(qMakePair(peer, messageId), download.id);
+    _queue.append(download.id);
+
+    saveDatabase();
+    pump();
+
+    return download.id;
+}
+
+void DownloadManager::cancel(qint64 peer, qint32 messageId)
+{
+    QMutexLocker lock(&_mutex);
+
+    qint64 downloadId = _messages.value(qMakePair(peer, messageId));
+    if (!downloadId) {
+        return;
+    }
+
+    Download download = _downloads.value(downloadId);
+    finish(downloadId);
+
+    if (download.requestId && _client) {
+        _client->cancelDownload(download.requestId);
+    }
+    QFile::remove(partFilePath(download.filePath));
+
+    emit downloadCanceled(peer, messageId);
+    pump();
+}
+
+qint64 DownloadManager::find(qint64 peer, qint32 messageId) const
+{
+    return _messages.value(qMakePair(peer, messageId));
+}
+
+bool DownloadManager::isActive(qint64 peer, qint32 messageId) const
+{
+    return _downloads.value(find(peer, messageId)).requestId != 0;
+}
+
+qint64 DownloadManager::received(qint64 peer, qint32 messageId) const
+{
+    return _downloads.value(find(peer, messageId)).received;
+}
+
+qint64 DownloadManager::total(qint64 peer, qint32 messageId) const
+{
+    return _downloads.value(find(peer, messageId)).total;
+}
+
+void DownloadManager::fileDownloading(TgLongVariant fileId, TgLongVariant processedLength, TgLongVariant totalLength, qint32 progressPercentage)
+{
+    Q_UNUSED(progressPercentage);
+    QMutexLocker lock(&_mutex);
+
+    qint64 downloadId = _requests.value(fileId.toLongLong());
+    if (!downloadId) {
+        return;
+    }
+
+    Download &download = _downloads[downloadId];
+    download.received = processedLength.toLongLong();
+    download.total = totalLength.toLongLong();
+
+    emit downloadProgress(download.peer, download.messageId, download.received, download.total);
+}
+
+void DownloadManager::fileDownloaded(TgLongVariant fileId, QString filePath)
+{
+    QMutexLocker lock(&_mutex);
+
+    qint64 downloadId = _requests.value(fileId.toLongLong());
+    if (!downloadId) {
+        return;
+    }
+
+    TRACE_REQUEST_FINISHED("upload.getFile", fileId.toLongLong());
+
+    Download download = _downloads.value(downloadId);
+    finish(downloadId);
+
+    QFile::remove(download.filePath);
+    if (!QFile::rename(filePath, download.filePath)) {
+        emit downloadCanceled(download.peer, download.messageId);
+    } else {
+        emit downloadFinished(download.peer, download.messageId, "file:///" + download.filePath);
+    }
+
+    pump();
+}
+
+void DownloadManager::fileDownloadCanceled(TgLongVariant fileId, QString filePath)
+{
+    Q_UNUSED(filePath);
+    QMutexLocker lock(&_mutex);
+
+    //Canceled by the client (connection lost, auth changed): keep it queued for a retry
+    qint64 downloadId = _requests.take(fileId.toLongLong());
+    if (!downloadId) {
+        return;
+    }
+
+    TRACE_REQUEST_FINISHED("upload.getFile", fileId.toLongLong());
+
+    _downloads[downloadId].requestId = 0;
+}
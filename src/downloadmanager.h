@@ -0,0 +1,84 @@
+#ifndef DOWNLOADMANAGER_H
+#define DOWNLOADMANAGER_H
+
+#include <QObject>
+
+#include <QMutex>
+#include <QHash>
+#include <QPair>
+#include "tgclient.h"
+#include "memorystats.h"
+
+class DownloadManager : public QObject, public MemoryReporter
+{
+    Q_OBJECT
+    Q_PROPERTY(QObject* client READ client WRITE setClient)
+    Q_PROPERTY(qint32 maxConcurrent READ maxConcurrent WRITE setMaxConcurrent)
+
+private:
+    struct Download {
+        qint64 id;
+        qint64 peer;
+        qint32 messageId;
+        TgObject input;
+        QString filePath;
+        qint64 requestId;
+        qint64 received;
+        qint64 total;
+    };
+
+    QMutex _mutex;
+    TgClient* _client;
+    TgLongVariant _userId;
+    qint32 _maxConcurrent;
+    qint64 _lastId;
+    bool _databaseLoaded;
+
+    QHash<qint64, Download> _downloads;
+    QList<qint64> _queue;
+    QHash<qint64, qint64> _requests;
+    QHash<QPair<qint64, qint32>, qint64> _messages;
+
+    void pump();
+    void start(Download &download);
+    void finish(qint64 downloadId);
+
+public:
+    explicit DownloadManager(QObject *parent = 0);
+    void readDatabase();
+    void saveDatabase();
+
+    void setClient(QObject *client);
+    QObject* client() const;
+
+    void setMaxConcurrent(qint32 count);
+    qint32 maxConcurrent() const;
+
+    static QString partFilePath(QString filePath);
+
+    TgList memoryUsage() const;
+
+signals:
+    void downloadStarted(qint64 peer, qint32 messageId);
+    void downloadProgress(qint64 peer, qint32 messageId, qint64 received, qint64 total);
+    void downloadFinished(qint64 peer, qint32 messageId, QString filePath);
+    void downloadCanceled(qint64 peer, qint32 messageId);
+
+public slots:
+    void loadDatabase();
+    void authorized(TgLongVariant userId);
+    void fileDownloading(TgLongVariant fileId, TgLongVariant processedLength, TgLongVariant totalLength, qint32 progressPercentage);
+    void fileDownloaded(TgLongVariant fileId, QString filePath);
+    void fileDownloadCanceled(TgLongVariant fileId, QString filePath);
+
+    qint64 enqueue(qint64 peer, qint32 messageId, TgObject input, QString filePath);
+    void cancel(qint64 peer, qint32 messageId);
+
+    qint64 find(qint64 peer, qint32 messageId) const;
+    bool isActive(qint64 peer, qint32 messageId) const;
+    qint64 received(qint64 peer, qint32 messageId) const;
+    qint64 total(qint64 peer, qint32 messageId) const;
+
+};
+
+#endif // DOWNLOADMANAGER_H
@@ -23,33 +23,73 @@
 
 #include <QGuiApplication>
 #include <QQmlContext>
+#include <QQmlEngine>
 #include <QQuickView>
 #include <QScopedPointer>
+#include <QTimer>
 
 #include <sailfishapp.h>
 #include <tgclient.h>
 
 #include "avatardownloader.h"
+#include "diskcachemanager.h"
+#include "downloadmanager.h"
+#include "notificationmanager.h"
+#include "readstatetracker.h"
+#include "updatessync.h"
+#include "strippedimageprovider.h"
+#include "startuptimeline.h"
+#include "memorystats.h"
+#include "tracer.h"
+#include "timeformatter.h"
 #include "models/dialogsmodel.h"
+#include "models/dialogsproxymodel.h"
 #include "models/foldersmodel.h"
 #include "models/messagesmodel.h"
+#include "models/searchresultsmodel.h"
 
 int main(int argc, char* argv[])
 {
+    StartupTimeline* timeline = StartupTimeline::instance();
+    timeline->mark(QStringLiteral("main"));
+
     QScopedPointer<QGuiApplication> application(SailfishApp::application(argc, argv));
     application->setOrganizationName(QStringLiteral("ru.neochapay"));
     application->setApplicationName(QStringLiteral("samoletik"));
+    timeline->mark(QStringLiteral("application_created"));
 
     TgClient::registerQML();
     qmlRegisterType<AvatarDownloader>("ru.neochapay.samoletik", 1, 0, "AvatarDownloader");
+    qmlRegisterType<DiskCacheManager>("ru.neochapay.samoletik", 1, 0, "DiskCacheManager");
+    qmlRegisterType<DownloadManager>("ru.neochapay.samoletik", 1, 0, "DownloadManager");
+    qmlRegisterType<NotificationManager>("ru.neochapay.samoletik", 1, 0, "NotificationManager");
+    qmlRegisterType<ReadStateTracker>("ru.neochapay.samoletik", 1, 0, "ReadStateTracker");
+    qmlRegisterType<UpdatesSync>("ru.neochapay.samoletik", 1, 0, "UpdatesSync");
     qmlRegisterType<DialogsModel>("ru.neochapay.samoletik", 1, 0, "DialogsModel");
+    qmlRegisterType<DialogsProxyModel>("ru.neochapay.samoletik", 1, 0, "DialogsProxyModel");
     qmlRegisterType<FoldersModel>("ru.neochapay.samoletik", 1, 0, "FoldersModel");
     qmlRegisterType<MessagesModel>("ru.neochapay.samoletik", 1, 0, "MessagesModel");
+    qmlRegisterType<SearchResultsModel>("ru.neochapay.samoletik", 1, 0, "SearchResultsModel");
+    timeline->mark(QStringLiteral("types_registered"));
 
     QScopedPointer<QQuickView> view(SailfishApp::createView());
+    view->engine()->addImageProvider(QStringLiteral("stripped"), new StrippedImageProvider);
+    view->rootContext()->setContextProperty(QStringLiteral("startupTimeline"), timeline);
+    view->rootContext()->setContextProperty(QStringLiteral("memoryStats"), MemoryStats::instance());
+    view->rootContext()->setContextProperty(QStringLiteral("tracer"), Tracer::instance());
+    view->rootContext()->setContextProperty(QStringLiteral("timeFormatter"), TimeFormatter::instance());
+    timeline->mark(QStringLiteral("view_created"));
 
     view->setSource(SailfishApp::pathTo("qml/Samoletik.qml"));
+    timeline->mark(QStringLiteral("qml_loaded"));
     view->show();
+    timeline->mark(QStringLiteral("view_shown"));
+
+    //Report whatever was reached if there is nothing to paint (no session, no avatars)
+    QTimer::singleShot(60000, timeline, SLOT(report()));
+
+    int result = application->exec();
+    Tracer::instance()->stop();
 
-    return application->exec();
+    return result;
 }
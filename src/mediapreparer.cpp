@@ -0,0 +1,76 @@
+#include "mediapreparer.h"
+
+#include <QImageReader>
+#include <QImageWriter>
+#include <QFileInfo>
+
+MediaPreparer::MediaPreparer(qint64 token, QString sourcePath, QString targetPath, qint32 maxSize, qint32 quality)
+    : QObject()
+    , QRunnable()
+    , m_token(token)
+    , m_sourcePath(sourcePath)
+    , m_targetPath(targetPath)
+    , m_maxSize(maxSize)
+    , m_quality(quality)
+{
+    //Deleted on the GUI thread, see run()
+    setAutoDelete(false);
+}
+
+bool MediaPreparer::isPhoto(QString filePath)
+{
+    QString suffix = QFileInfo(filePath).suffix().toLower();
+    return suffix == "jpg" || suffix == "jpeg" || suffix == "png";
+}
+
+bool MediaPreparer::isOpaque(const QImage &image)
+{
+    if (!image.hasAlphaChannel()) {
+        return true;
+    }
+
+    QImage argb = image.convertToFormat(QImage::Format_ARGB32);
+    for (qint32 y = 0; y < argb.height(); ++y) {
+        const QRgb* line = reinterpret_cast<const QRgb*>(argb.constScanLine(y));
+        for (qint32 x = 0; x < argb.width(); ++x) {
+            if (qAlpha(line[x]) != 255) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+void MediaPreparer::run()
+{
+    QString result;
+
+    QImageReader reader(m_sourcePath);
+    reader.setAutoTransform(true);
+
+    QSize size = reader.size();
+    if (size.isValid() && qMax(size.width(), size.height()) > m_maxSize) {
+        reader.setScaledSize(size.scaled(m_maxSize, m_maxSize, Qt::KeepAspectRatio));
+    }
+
+    QImage image = reader.read();
+    if (!image.isNull()) {
+        //JPEG would flatten transparent pixels to black
+        bool opaque = isOpaque(image);
+        QString filePath = m_targetPath + (opaque ? ".jpg" : ".png");
+
+        QImageWriter writer(filePath, opaque ? "jpg" : "png");
+        if (opaque) {
+            writer.setQuality(m_quality);
+        }
+
+        if (writer.write(image)) {
+            result = filePath;
+        }
+    }
+
+    //Queued to the GUI thread, a receiver destroyed meanwhile is disconnected already
+    emit prepared(m_token, result);
+    deleteLater();
+}
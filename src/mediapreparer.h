@@ -0,0 +1,38 @@
+#ifndef MEDIAPREPARER_H
+#define MEDIAPREPARER_H
+
+#include <QRunnable>
+#include <QObject>
+#include <QString>
+#include <QImage>
+
+//Downscales and recompresses a photo before upload, on a QThreadPool thread.
+//Opaque images are written as JPEG, images with transparency stay PNG. The
+//file is written to targetPath plus ".jpg" or ".png", an empty path in
+//prepared() means that the source could not be read. The preparer is created on
+//the GUI thread and stays there, prepared() is queued to the receivers and the
+//preparer deletes itself afterwards.
+class MediaPreparer : public QObject, public QRunnable
+{
+    Q_OBJECT
+
+public:
+    MediaPreparer(qint64 token, QString sourcePath, QString targetPath, qint32 maxSize, qint32 quality);
+
+    void run();
+
+    static bool isPhoto(QString filePath);
+    static bool isOpaque(const QImage &image);
+
+signals:
+    void prepared(qint64 token, QString filePath);
+
+private:
+    qint64 m_token;
+    QString m_sourcePath;
+    QString m_targetPath;
+    qint32 m_maxSize;
+    qint32 m_quality;
+};
+
+#endif // MEDIAPREPARER_H
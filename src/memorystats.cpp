@@ -0,0 +1,142 @@
+#include "memorystats.h"
+
+#include <QDebug>
+
+//Rough per-allocation overheads of Qt 5 containers on a 64 bit target
+#define DATA_HEADER_SIZE 24
+#define MAP_NODE_SIZE 40
+#define LIST_ITEM_SIZE 8
+
+MemoryReporter::MemoryReporter(QString component)
+    : m_component(component)
+{
+    MemoryStats::instance()->addReporter(this);
+}
+
+MemoryReporter::~MemoryReporter()
+{
+    MemoryStats::instance()->removeReporter(this);
+}
+
+QString MemoryReporter::memoryComponent() const
+{
+    return m_component;
+}
+
+MemoryStats* MemoryStats::instance()
+{
+    static MemoryStats* stats = new MemoryStats();
+    return stats;
+}
+
+MemoryStats::MemoryStats(QObject *parent)
+    : QObject(parent)
+    , m_reporters()
+{
+}
+
+void MemoryStats::addReporter(MemoryReporter *reporter)
+{
+    m_reporters.append(reporter);
+}
+
+void MemoryStats::removeReporter(MemoryReporter *reporter)
+{
+    m_reporters.removeOne(reporter);
+}
+
+TgObject MemoryStats::usage(QString name, qint64 entries, qint64 bytes)
+{
+    TgObject usage;
+    usage["name"] = name;
+    usage["entries"] = entries;
+    usage["bytes"] = bytes;
+    return usage;
+}
+
+qint64 MemoryStats::variantSize(const QVariant &value)
+{
+    qint64 size = sizeof(QVariant);
+
+    switch (value.type()) {
+    case QVariant::String:
+        size += DATA_HEADER_SIZE + value.toString().size() * sizeof(QChar);
+        break;
+    case QVariant::ByteArray:
+        size += DATA_HEADER_SIZE + value.toByteArray().size();
+        break;
+    case QVariant::Map:
+        size += objectSize(value.toMap());
+        break;
+    case QVariant::List:
+    {
+        TgList list = value.toList();
+        size += DATA_HEADER_SIZE;
+        for (qint32 i = 0; i < list.size(); ++i) {
+            size += LIST_ITEM_SIZE + variantSize(list[i]);
+        }
+        break;
+    }
+    default:
+        break;
+    }
+
+    return size;
+}
+
+qint64 MemoryStats::objectSize(const TgObject &object)
+{
+    qint64 size = DATA_HEADER_SIZE;
+
+    for (TgObject::const_iterator i = object.constBegin(); i != object.constEnd(); ++i) {
+        size += MAP_NODE_SIZE + DATA_HEADER_SIZE + i.key().size() * sizeof(QChar);
+        size += variantSize(i.value());
+    }
+
+    return size;
+}
+
+TgList MemoryStats::report()
+{
+    TgList report;
+
+    for (qint32 i = 0; i < m_reporters.size(); ++i) {
+        TgList usage = m_reporters[i]->memoryUsage();
+        for (qint32 j = 0; j < usage.size(); ++j) {
+            TgObject entry = usage[j].toMap();
+            entry["component"] = m_reporters[i]->memoryComponent();
+            report << entry;
+        }
+    }
+
+    return report;
+}
+
+qint64 MemoryStats::totalBytes()
+{
+    TgList entries = report();
+
+    qint64 total = 0;
+    for (qint32 i = 0; i < entries.size(); ++i) {
+        total += entries[i].toMap()["bytes"].toLongLong();
+    }
+
+    return total;
+}
+
+void MemoryStats::dump()
+{
+    TgList entries = report();
+
+    qint64 total = 0;
+    for (qint32 i = 0; i < entries.size(); ++i) {
+        TgObject entry = entries[i].toMap();
+        total += entry["bytes"].toLongLong();
+
+        qDebug().noquote() << "Memory:" << entry["component"].toString() + "." + entry["name"].toString()
+                           << entry["entries"].toLongLong() << "entries"
+                           << entry["bytes"].toLongLong() / 1024 << "KiB";
+    }
+
+    qDebug().noquote() << "Memory: total" << total / 1024 << "KiB";
+}
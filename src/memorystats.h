@@ -0,0 +1,51 @@
+#ifndef MEMORYSTATS_H
+#define MEMORYSTATS_H
+
+#include <QObject>
+#include <QList>
+#include "tgclient.h"
+
+//Implemented by models and caches that can tell roughly how much memory they hold.
+//memoryUsage() returns one MemoryStats::usage() entry per tracked container.
+class MemoryReporter
+{
+public:
+    explicit MemoryReporter(QString component);
+    virtual ~MemoryReporter();
+
+    QString memoryComponent() const;
+    virtual TgList memoryUsage() const = 0;
+
+private:
+    QString m_component;
+};
+
+//Registry of all live reporters. Sizes are estimates of heap usage (payload plus
+//Qt container overhead), meant for comparing components, not for exact totals.
+//Call from the GUI thread, reporters are read without taking their locks.
+class MemoryStats : public QObject
+{
+    Q_OBJECT
+
+public:
+    static MemoryStats* instance();
+
+    void addReporter(MemoryReporter *reporter);
+    void removeReporter(MemoryReporter *reporter);
+
+    static TgObject usage(QString name, qint64 entries, qint64 bytes);
+    static qint64 variantSize(const QVariant &value);
+    static qint64 objectSize(const TgObject &object);
+
+public slots:
+    TgList report();
+    qint64 totalBytes();
+    void dump();
+
+private:
+    explicit MemoryStats(QObject *parent = 0);
+
+    QList<MemoryReporter*> m_reporters;
+};
+
+#endif // MEMORYSTATS_H
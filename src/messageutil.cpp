@@ -3,10 +3,15 @@
 #include "tlschema.h"
 #include "tgclient.h"
 #include <QDateTime>
+#include <QHash>
+#include "memorystats.h"
+#include "tracer.h"
 
 //TODO use SQLite
 TgList m_globalUsers;
 TgList m_globalChats;
+//Dialog peers merged with their dialog, addressed by compact handles from QML
+QHash<qint64, TgObject> m_globalPeers;
 
 TgList& globalUsers()
 {
@@ -18,6 +23,79 @@ TgList& globalChats()
     return m_globalChats;
 }
 
+qint64 peerHandle(TgObject peer)
+{
+    qint64 type = 0;
+    if (TgClient::isChannel(peer)) {
+        type = 3;
+    } else if (TgClient::isChat(peer)) {
+        type = 2;
+    } else if (TgClient::isUser(peer)) {
+        type = 1;
+    }
+
+    if (type == 0) {
+        return 0;
+    }
+
+    //Handles reach QML as JS numbers, exact below 2^53. Ids are far below that bound,
+    //user ids are under 2^40 and chat and channel ids under 10^12 (also below 2^40),
+    //so a handle stays under 2^42. A 52-bit id would need 54 bits and lose precision.
+    return TgClient::getPeerId(peer).toLongLong() * 4 + type;
+}
+
+//Handle of a channel known only by id, as in channel updates
+qint64 channelHandle(qint64 channelId)
+{
+    return channelId * 4 + 3;
+}
+
+bool isChannelHandle(qint64 handle)
+{
+    return handle % 4 == 3;
+}
+
+qint64 registerPeer(TgObject peer)
+{
+    qint64 handle = peerHandle(peer);
+    if (handle != 0) {
+        m_globalPeers.insert(handle, peer);
+    }
+
+    return handle;
+}
+
+TgObject registeredPeer(qint64 handle)
+{
+    return m_globalPeers.value(handle);
+}
+
+class GlobalsMemoryReporter : public MemoryReporter
+{
+public:
+    GlobalsMemoryReporter()
+        : MemoryReporter("Globals")
+    {
+    }
+
+    TgList memoryUsage() const
+    {
+        //Registered peers share their data with dialog rows, so they are partly counted twice
+        qint64 peersBytes = 0;
+        for (QHash<qint64, TgObject>::const_iterator i = m_globalPeers.constBegin(); i != m_globalPeers.constEnd(); ++i) {
+            peersBytes += sizeof(qint64) + MemoryStats::objectSize(i.value());
+        }
+
+        TgList usage;
+        usage << MemoryStats::usage("users", m_globalUsers.size(), MemoryStats::variantSize(m_globalUsers));
+        usage << MemoryStats::usage("chats", m_globalChats.size(), MemoryStats::variantSize(m_globalChats));
+        usage << MemoryStats::usage("peers", m_globalPeers.size(), peersBytes);
+        return usage;
+    }
+};
+
+static GlobalsMemoryReporter s_globalsMemoryReporter;
+
 using namespace TLType;
 
 bool entitiesSorter(const QVariant &v1, const QVariant &v2)
@@ -159,6 +237,7 @@ QString prepareDialogItemMessage(QString text, TgList entities)
 
 QString messageToHtml(QString text, TgList entities)
 {
+    TRACE_SPAN_ARG("messageToHtml", "length", text.size());
     //TODO unite neighbour spoilers
     if (text.isEmpty()) {
         return text;
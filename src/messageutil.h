@@ -5,6 +5,11 @@
 
 TgList& globalUsers();
 TgList& globalChats();
+qint64 peerHandle(TgObject peer);
+qint64 channelHandle(qint64 channelId);
+bool isChannelHandle(qint64 handle);
+qint64 registerPeer(TgObject peer);
+TgObject registeredPeer(qint64 handle);
 QString prepareDialogItemMessage(QString text, TgList entities);
 QString messageToHtml(QString text, TgList entities);
 void handleMessageAction(TgObject &row, TgObject message, TgObject sender, TgList users, TgList chats);
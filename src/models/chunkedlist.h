@@ -0,0 +1,206 @@
+#ifndef CHUNKEDLIST_H
+#define CHUNKEDLIST_H
+
+#include <QList>
+
+//Deque-like container for history rows.
+//Items live in fixed size chunks, so prepending a page of older messages only
+//allocates chunks in front instead of copying the whole list, and access by
+//row index stays O(1).
+template <typename T, int ChunkSize = 128>
+class ChunkedList
+{
+public:
+    ChunkedList()
+        : m_chunks()
+        , m_front(0)
+        , m_size(0)
+    {
+    }
+
+    ChunkedList(const ChunkedList &other)
+        : m_chunks()
+        , m_front(0)
+        , m_size(0)
+    {
+        append(other);
+    }
+
+    ~ChunkedList()
+    {
+        clear();
+    }
+
+    ChunkedList &operator=(const ChunkedList &other)
+    {
+        if (this != &other) {
+            clear();
+            append(other);
+        }
+
+        return *this;
+    }
+
+    int size() const
+    {
+        return m_size;
+    }
+
+    bool isEmpty() const
+    {
+        return m_size == 0;
+    }
+
+    T &operator[](int i)
+    {
+        return m_chunks[(m_front + i) / ChunkSize][(m_front + i) % ChunkSize];
+    }
+
+    const T &operator[](int i) const
+    {
+        return m_chunks[(m_front + i) / ChunkSize][(m_front + i) % ChunkSize];
+    }
+
+    const T &at(int i) const
+    {
+        return (*this)[i];
+    }
+
+    const T &first() const
+    {
+        return at(0);
+    }
+
+    const T &last() const
+    {
+        return at(m_size - 1);
+    }
+
+    void append(const T &value)
+    {
+        int slot = m_front + m_size;
+        if (slot == m_chunks.size() * ChunkSize) {
+            m_chunks.append(new T[ChunkSize]);
+        }
+
+        m_chunks[slot / ChunkSize][slot % ChunkSize] = value;
+        ++m_size;
+    }
+
+    void append(const QList<T> &values)
+    {
+        for (int i = 0; i < values.size(); ++i) {
+            append(values[i]);
+        }
+    }
+
+    void append(const ChunkedList &other)
+    {
+        for (int i = 0; i < other.size(); ++i) {
+            append(other[i]);
+        }
+    }
+
+    void prepend(const QList<T> &values)
+    {
+        for (int i = values.size() - 1; i >= 0; --i) {
+            if (m_front == 0) {
+                m_chunks.prepend(new T[ChunkSize]);
+                m_front = ChunkSize;
+            }
+
+            --m_front;
+            m_chunks.first()[m_front] = values[i];
+            ++m_size;
+        }
+    }
+
+    void replace(int i, const T &value)
+    {
+        (*this)[i] = value;
+    }
+
+    void removeFirst(int count)
+    {
+        count = qMin(count, m_size);
+        if (count <= 0) {
+            return;
+        }
+
+        //Release the values right away, chunks may stay allocated
+        for (int i = 0; i < count; ++i) {
+            (*this)[i] = T();
+        }
+
+        m_front += count;
+        m_size -= count;
+
+        if (m_size == 0) {
+            clear();
+            return;
+        }
+
+        while (m_front >= ChunkSize) {
+            delete[] m_chunks.takeFirst();
+            m_front -= ChunkSize;
+        }
+    }
+
+    void removeLast(int count)
+    {
+        count = qMin(count, m_size);
+        if (count <= 0) {
+            return;
+        }
+
+        for (int i = m_size - count; i < m_size; ++i) {
+            (*this)[i] = T();
+        }
+
+        m_size -= count;
+
+        if (m_size == 0) {
+            clear();
+            return;
+        }
+
+        int usedChunks = (m_front + m_size + ChunkSize - 1) / ChunkSize;
+        while (m_chunks.size() > usedChunks) {
+            delete[] m_chunks.takeLast();
+        }
+    }
+
+    void removeAt(int i)
+    {
+        //Shift the shorter side
+        if (i < m_size / 2) {
+            for (int j = i; j > 0; --j) {
+                (*this)[j] = (*this)[j - 1];
+            }
+            removeFirst(1);
+        } else {
+            for (int j = i; j < m_size - 1; ++j) {
+                (*this)[j] = (*this)[j + 1];
+            }
+            removeLast(1);
+        }
+    }
+
+    void clear()
+    {
+        for (int i = 0; i < m_chunks.size(); ++i) {
+            delete[] m_chunks[i];
+        }
+
+        m_chunks.clear();
+        m_front = 0;
+        m_size = 0;
+    }
+
+private:
+    QList<T*> m_chunks;
+    int m_front;
+    int m_size;
+};
+
+#endif // CHUNKEDLIST_H
@@ -1,25 +1,39 @@
 #include "dialogsmodel.h"
 
 #include "tlschema.h"
-#include <QMutexLocker>
 #include <QColor>
 #include <QDateTime>
+#include <QMap>
+#include <QSet>
 #include "messageutil.h"
+#include "startuptimeline.h"
+#include "tracer.h"
+#include "timeformatter.h"
 
-//TODO archived chats
+#define DIALOGS_PAGE_SIZE 40
+//Page key of messages.getPeerDialogs requests, which are never continued
+#define PEER_DIALOGS_PAGE -1
 
 DialogsModel::DialogsModel(QObject *parent)
-    : QAbstractListModel(parent)
-    , m_mutex(QMutex::Recursive)
+    : DiffListModel(parent)
+    , MemoryReporter("DialogsModel")
     , m_dialogs()
     , m_client(nullptr)
     , m_userId(0)
-    , m_requestId(0)
-    , m_offsets()
+    , m_pages()
+    , m_pendingFilter(-1)
+    , m_refreshing(false)
+    , m_refreshRows()
+    , m_loaded(false)
     , m_avatarDownloader(nullptr)
     , m_folders(nullptr)
     , m_lastPinnedIndex(-1)
+    , m_readState(nullptr)
+    , m_updates(nullptr)
+    , m_ingestor(new Ingestor(this))
 {
+    connect(m_ingestor, SIGNAL(batchesReady()), this, SLOT(applyBatches()));
+    connect(TimeFormatter::instance(), SIGNAL(changed()), this, SLOT(timeFormatChanged()));
 }
 
 DialogsModel::~DialogsModel()
@@ -37,8 +51,6 @@ DialogsModel::~DialogsModel()
 
 void DialogsModel::setFolders(QObject *model)
 {
-    QMutexLocker lock(&m_mutex);
-
     if (m_folders) {
         m_folders->disconnect(this);
     }
@@ -59,9 +71,89 @@ QObject* DialogsModel::folders() const
     return m_folders;
 }
 
+void DialogsModel::setReadState(QObject *tracker)
+{
+    if (m_readState) {
+        m_readState->disconnect(this);
+    }
+
+    m_readState = dynamic_cast<ReadStateTracker*>(tracker);
+    if (!m_readState) {
+        return;
+    }
+
+    connect(m_readState, SIGNAL(readStateChanged(qint64,qint32,qint32)), this, SLOT(readStateChanged(qint64,qint32,qint32)));
+}
+
+QObject* DialogsModel::readState() const
+{
+    return m_readState;
+}
+
+void DialogsModel::setUpdates(QObject *sync)
+{
+    if (m_updates) {
+        m_updates->disconnect(this);
+    }
+
+    m_updates = dynamic_cast<UpdatesSync*>(sync);
+    if (!m_updates) {
+        return;
+    }
+
+    if (m_client) {
+        disconnect(m_client, SIGNAL(gotUpdate(TgObject,TgLongVariant,TgList,TgList,qint32,qint32,qint32)), this, SLOT(gotUpdate(TgObject,TgLongVariant,TgList,TgList,qint32,qint32,qint32)));
+    }
+
+    //Sequenced live updates and the ones missed while disconnected are replayed the same way
+    connect(m_updates, SIGNAL(gotUpdate(TgObject,TgLongVariant,TgList,TgList,qint32,qint32,qint32)), this, SLOT(gotUpdate(TgObject,TgLongVariant,TgList,TgList,qint32,qint32,qint32)));
+}
+
+QObject* DialogsModel::updates() const
+{
+    return m_updates;
+}
+
+bool DialogsModel::loaded() const
+{
+    return m_loaded;
+}
+
+void DialogsModel::readStateChanged(qint64 peer, qint32 maxId, qint32 readCount)
+{
+    for (qint32 i = 0; i < m_dialogs.size(); ++i) {
+        TgObject row = m_dialogs[i];
+        if (row["peerHandle"].toLongLong() != peer) {
+            continue;
+        }
+
+        TgObject dialogPeer = row["peer"].toMap();
+        if (maxId <= dialogPeer["read_inbox_max_id"].toInt()) {
+            return;
+        }
+
+        //Everything up to the last message is read, otherwise only what the viewport went through
+        qint32 unreadCount = 0;
+        if (maxId < row["topMessage"].toInt()) {
+            unreadCount = qMax(0, row["unreadCount"].toInt() - readCount);
+        }
+
+        dialogPeer["read_inbox_max_id"] = maxId;
+        dialogPeer["unread_count"] = unreadCount;
+        row["peer"] = dialogPeer;
+        row["unreadCount"] = unreadCount;
+
+        registerPeer(dialogPeer);
+        m_dialogs[i] = row;
+
+        emit dataChanged(index(i), index(i), QVector<int>() << UnreadCountRole);
+        return;
+    }
+}
+
 void DialogsModel::foldersChanged(QList<TgObject> folders)
 {
-    QMutexLocker lock(&m_mutex);
+    TRACE_SPAN_ARG("DialogsModel::foldersChanged", "folders", folders.size());
 
     for (qint32 i = 0; i < m_dialogs.size(); ++i) {
         TgObject row = m_dialogs[i];
@@ -69,7 +161,7 @@ void DialogsModel::foldersChanged(QList<TgObject> folders)
         TgList dialogFolders;
 
         for (qint32 j = 0; j < folders.size(); ++j) {
-            if (FoldersModel::matchesFilter(folders[j], qDeserialize(row["peerBytes"].toByteArray()).toMap())) {
+            if (FoldersModel::matchesFilter(folders[j], row["peer"].toMap())) {
                 dialogFolders << j;
             }
         }
@@ -90,10 +182,19 @@ void DialogsModel::resetState()
         endRemoveRows();
     }
 
-    m_requestId = 0;
-    m_offsets = TgObject();
-    m_offsets["_start"] = true;
+    //Only the main list is loaded up front, other folders wait for loadFolder()
+    m_pages.clear();
+    m_pages[0].offsets["_start"] = true;
+    m_pages[0].requestId = 0;
+    m_pendingFilter = -1;
     m_lastPinnedIndex = -1;
+    m_refreshing = false;
+    m_refreshRows.clear();
+
+    if (m_loaded) {
+        m_loaded = false;
+        emit loadedChanged();
+    }
 }
 
 QHash<int, QByteArray> DialogsModel::roleNames() const
@@ -110,9 +211,12 @@ QHash<int, QByteArray> DialogsModel::roleNames() const
     roles[MessageTimeRole] = "messageTime";
     roles[MessageTextRole] = "messageText";
     roles[TooltipRole] = "tooltip";
-    roles[PeerBytesRole] = "peerBytes";
+    roles[PeerHandleRole] = "peerHandle";
     roles[MessageSenderNameRole] = "messageSenderName";
     roles[MessageSenderColorRole] = "messageSenderColor";
+    roles[UnreadCountRole] = "unreadCount";
+    roles[FolderIdRole] = "folderId";
+    roles[UsernameRole] = "username";
 
     return roles;
 }
@@ -124,8 +228,6 @@ void DialogsModel::setClient(QObject *client)
         return;
     }
 
-    QMutexLocker lock(&m_mutex);
-
     if (m_client) {
         m_client->disconnect(this);
     }
@@ -137,7 +239,11 @@ void DialogsModel::setClient(QObject *client)
 
     connect(m_client, SIGNAL(authorized(TgLongVariant)), this, SLOT(authorized(TgLongVariant)));
     connect(m_client, SIGNAL(messagesDialogsResponse(TgObject,TgLongVariant)), this, SLOT(messagesGetDialogsResponse(TgObject,TgLongVariant)));
-    connect(m_client, SIGNAL(gotUpdate(TgObject,TgLongVariant,TgList,TgList,qint32,qint32,qint32)), this, SLOT(gotUpdate(TgObject,TgLongVariant,TgList,TgList,qint32,qint32,qint32)));
+    connect(m_client, SIGNAL(messagesPeerDialogsResponse(TgObject,TgLongVariant)), this, SLOT(messagesGetPeerDialogsResponse(TgObject,TgLongVariant)));
+    //With an UpdatesSync set, live updates come from it in order
+    if (!m_updates) {
+        connect(m_client, SIGNAL(gotUpdate(TgObject,TgLongVariant,TgList,TgList,qint32,qint32,qint32)), this, SLOT(gotUpdate(TgObject,TgLongVariant,TgList,TgList,qint32,qint32,qint32)));
+    }
 }
 
 QObject* DialogsModel::client() const
@@ -147,7 +253,6 @@ QObject* DialogsModel::client() const
 
 void DialogsModel::setAvatarDownloader(QObject *avatarDownloader)
 {
-    QMutexLocker lock(&m_mutex);
     AvatarDownloader* tavatarDownloader = dynamic_cast<AvatarDownloader*>(avatarDownloader);
     if(!tavatarDownloader) {
         return;
@@ -177,30 +282,123 @@ QVariant DialogsModel::data(const QModelIndex &index, int role) const
     if (index.row() < 0) //TODO why this is even calling
         return QVariant();
 
+    if (role == MessageTimeRole) {
+        return TimeFormatter::instance()->dialogTime(m_dialogs[index.row()]["messageDate"].toInt());
+    }
+
     return m_dialogs[index.row()][roleNames()[role]];
 }
 
-bool DialogsModel::canFetchMoreDownwards() const
+void DialogsModel::timeFormatChanged()
+{
+    if (m_dialogs.isEmpty()) {
+        return;
+    }
+
+    emit dataChanged(index(0), index(m_dialogs.size() - 1), QVector<int>() << MessageTimeRole);
+}
+
+TgList DialogsModel::memoryUsage() const
+{
+    qint64 bytes = 0;
+    for (qint32 i = 0; i < m_dialogs.size(); ++i) {
+        bytes += MemoryStats::objectSize(m_dialogs[i]);
+    }
+
+    TgList usage;
+    usage << MemoryStats::usage("rows", m_dialogs.size(), bytes);
+    return usage;
+}
+
+bool DialogsModel::canFetchMoreDownwards(qint32 folderId) const
 {
     if(!m_client) {
         return false;
     }
-    return m_client && m_client->isAuthorized() && !m_requestId.toLongLong() && !m_offsets.isEmpty();
+
+    FolderPage page = m_pages.value(folderId);
+    return m_client && m_client->isAuthorized() && !page.requestId.toLongLong() && !page.offsets.isEmpty();
+}
+
+void DialogsModel::fetchMoreDownwards(qint32 folderId)
+{
+    if(!m_client || !m_pages.contains(folderId)) {
+        return;
+    }
+
+    FolderPage &page = m_pages[folderId];
+
+    TgObject offsets = page.offsets;
+    if (folderId != 0) {
+        offsets["folder_id"] = folderId;
+    }
+
+    page.requestId = m_client->messagesGetDialogsWithOffsets(offsets, DIALOGS_PAGE_SIZE);
+    TRACE_REQUEST_ISSUED("messages.getDialogs", page.requestId.toLongLong());
 }
 
-void DialogsModel::fetchMoreDownwards()
+void DialogsModel::loadFolder(qint32 folderId)
 {
-    QMutexLocker lock(&m_mutex);   
-    if(!m_client) {
+    if (folderId < 0 || m_pages.contains(folderId)) {
+        return;
+    }
+
+    m_pages[folderId].offsets["_start"] = true;
+    m_pages[folderId].requestId = 0;
+
+    if (canFetchMoreDownwards(folderId)) {
+        fetchMoreDownwards(folderId);
+    }
+}
+
+void DialogsModel::loadFilter(qint32 folderIndex)
+{
+    if (!m_client || !m_client->isAuthorized() || !m_folders) {
+        return;
+    }
+
+    //One request at a time, only the latest filter is loaded once it is done
+    if (m_pages.contains(PEER_DIALOGS_PAGE)) {
+        m_pendingFilter = folderIndex;
+        return;
+    }
+
+    QList<TgObject> folders = m_folders->folders();
+    if (folderIndex < 0 || folderIndex >= folders.size()) {
+        return;
+    }
+
+    //Peers a filter names explicitly may not be in the loaded pages yet
+    QSet<qint64> loaded;
+    for (qint32 i = 0; i < m_dialogs.size(); ++i) {
+        loaded.insert(m_dialogs[i]["peerHandle"].toLongLong());
+    }
+
+    TgList peers = folders[folderIndex]["pinned_peers"].toList() + folders[folderIndex]["include_peers"].toList();
+    TgVector dialogPeers;
+    for (qint32 i = 0; i < peers.size(); ++i) {
+        TgObject peer = peers[i].toMap();
+        if (loaded.contains(peerHandle(peer))) {
+            continue;
+        }
+
+        TgObject dialogPeer;
+        ID_PROPERTY(dialogPeer) = TLType::InputDialogPeer;
+        dialogPeer["peer"] = peer;
+        dialogPeers << dialogPeer;
+    }
+
+    if (dialogPeers.isEmpty()) {
         return;
     }
 
-    m_requestId = m_client->messagesGetDialogsWithOffsets(m_offsets, 40);
+    m_pages[PEER_DIALOGS_PAGE].requestId = m_client->messagesGetPeerDialogs(dialogPeers);
+    TRACE_REQUEST_ISSUED("messages.getPeerDialogs", m_pages[PEER_DIALOGS_PAGE].requestId.toLongLong());
 }
 
 void DialogsModel::authorized(TgLongVariant userId)
 {
-    QMutexLocker lock(&m_mutex);
+    StartupTimeline::instance()->mark("session_restored");
 
     if (m_userId != userId) {
         resetState();
@@ -211,52 +409,76 @@ void DialogsModel::authorized(TgLongVariant userId)
 
 void DialogsModel::messagesGetDialogsResponse(TgObject data, TgLongVariant messageId)
 {
-    QMutexLocker lock(&m_mutex);
+    qint32 folderId = -1;
+    for (QHash<qint32, FolderPage>::const_iterator i = m_pages.constBegin(); i != m_pages.constEnd(); ++i) {
+        if (i.key() != PEER_DIALOGS_PAGE && i.value().requestId == messageId) {
+            folderId = i.key();
+            break;
+        }
+    }
 
-    if (m_requestId != messageId) {
+    if (folderId == -1) {
         return;
     }
 
-    m_requestId = 0;
+    TRACE_REQUEST_FINISHED("messages.getDialogs", messageId.toLongLong());
+    if (folderId == 0) {
+        StartupTimeline::instance()->mark("dialogs_first_response");
+    }
 
     switch (GETID(data)) {
     case TLType::MessagesDialogs:
     case TLType::MessagesDialogsNotModified:
-        m_offsets = TgObject();
+        m_pages[folderId].offsets = TgObject();
         break;
     case TLType::MessagesDialogsSlice:
-        m_offsets = TgClient::getDialogsOffsets(data);
+        m_pages[folderId].offsets = TgClient::getDialogsOffsets(data);
         break;
     }
 
-    TgList dialogsList = data["dialogs"].toList();
-    TgList messagesList = data["messages"].toList();
-    TgList usersList = data["users"].toList();
-    TgList chatsList = data["chats"].toList();
+    //The page request id stays set until the batch is applied, so no next page is requested before
+    QList<TgObject> folders;
+    if (m_folders) {
+        folders = m_folders->folders();
+    }
 
-    globalUsers().append(usersList);
-    globalChats().append(chatsList);
+    m_ingestor->post([data, folders, messageId, folderId]() {
+        return buildDialogsBatch(data, folders, messageId, folderId);
+    });
+}
 
-    if (dialogsList.isEmpty()) {
-        m_offsets = TgObject();
+void DialogsModel::messagesGetPeerDialogsResponse(TgObject data, TgLongVariant messageId)
+{
+    if (!m_pages.contains(PEER_DIALOGS_PAGE) || m_pages[PEER_DIALOGS_PAGE].requestId != messageId) {
         return;
     }
 
-    QList<TgObject> dialogsRows;
-    dialogsRows.reserve(dialogsList.size());
+    TRACE_REQUEST_FINISHED("messages.getPeerDialogs", messageId.toLongLong());
 
     QList<TgObject> folders;
     if (m_folders) {
         folders = m_folders->folders();
     }
 
+    m_ingestor->post([data, folders, messageId]() {
+        return buildDialogsBatch(data, folders, messageId, PEER_DIALOGS_PAGE);
+    });
+}
+
+TgObject DialogsModel::buildDialogsBatch(TgObject data, QList<TgObject> folders, TgLongVariant requestId, qint32 page)
+{
+    TRACE_SPAN_ARG("DialogsModel::buildDialogsBatch", "requestId", requestId.toLongLong());
+
+    TgList dialogsList = data["dialogs"].toList();
+    TgList messagesList = data["messages"].toList();
+    TgList usersList = data["users"].toList();
+    TgList chatsList = data["chats"].toList();
+
+    TgList dialogsRows;
+
     for (qint32 i = 0; i < dialogsList.size(); ++i) {
         TgObject lastDialog = dialogsList[i].toMap();
 
-        if (lastDialog["pinned"].toBool()) {
-            m_lastPinnedIndex = qMax(m_lastPinnedIndex, m_dialogs.size() + i);
-        }
-
         TgObject lastDialogPeer = lastDialog["peer"].toMap();
         TgInt lastMessageId = lastDialog["top_message"].toInt();
 
@@ -305,12 +527,122 @@ void DialogsModel::messagesGetDialogsResponse(TgObject data, TgLongVariant messa
                 }
             }
 
-        dialogsRows.append(createRow(lastDialog, lastPeer, lastMessage, messageSender, folders, usersList, chatsList));
+        dialogsRows << createRow(lastDialog, lastPeer, lastMessage, messageSender, folders, usersList, chatsList);
+    }
+
+    TgObject batch;
+    batch["requestId"] = requestId;
+    batch["page"] = page;
+    batch["rows"] = dialogsRows;
+    batch["users"] = usersList;
+    batch["chats"] = chatsList;
+
+    return batch;
+}
+
+void DialogsModel::applyBatches()
+{
+    TgObject batch;
+    while (m_ingestor->takeBatch(batch)) {
+        //Dropped by resetState() or a newer request meanwhile
+        qint32 page = batch["page"].toInt();
+        if (!m_pages.contains(page) || batch["requestId"] != m_pages[page].requestId) {
+            continue;
+        }
+
+        if (page == PEER_DIALOGS_PAGE) {
+            m_pages.remove(PEER_DIALOGS_PAGE);
+        } else {
+            m_pages[page].requestId = 0;
+        }
+        applyDialogsBatch(batch);
+
+        if (page == PEER_DIALOGS_PAGE && m_pendingFilter != -1) {
+            qint32 folderIndex = m_pendingFilter;
+            m_pendingFilter = -1;
+            loadFilter(folderIndex);
+        }
     }
+}
+
+void DialogsModel::applyDialogsBatch(TgObject batch)
+{
+    TgList dialogsRows = batch["rows"].toList();
+    TgList usersList = batch["users"].toList();
+    TgList chatsList = batch["chats"].toList();
+    qint32 page = batch["page"].toInt();
+    bool refreshing = m_refreshing && page == 0;
+
+    globalUsers().append(usersList);
+    globalChats().append(chatsList);
+
+    if (page == 0 && !m_loaded) {
+        m_loaded = true;
+        emit loadedChanged();
+    }
+
+    if (dialogsRows.isEmpty()) {
+        if (m_pages.contains(page)) {
+            m_pages[page].offsets = TgObject();
+        }
+
+        if (refreshing) {
+            finishRefresh();
+        }
+        return;
+    }
+
+    if (refreshing) {
+        for (qint32 i = 0; i < dialogsRows.size(); ++i) {
+            TgObject row = dialogsRows[i].toMap();
+            registerPeer(row["peer"].toMap());
+            m_refreshRows.append(row);
+        }
+    } else {
+        //A dialog can come again from another folder or a filter, it is updated in place then
+        QHash<qint64, qint32> loaded;
+        for (qint32 i = 0; i < m_dialogs.size(); ++i) {
+            loaded.insert(m_dialogs[i]["peerHandle"].toLongLong(), i);
+        }
+
+        QList<TgObject> rows;
+        rows.reserve(dialogsRows.size());
+
+        for (qint32 i = 0; i < dialogsRows.size(); ++i) {
+            TgObject row = dialogsRows[i].toMap();
+            registerPeer(row["peer"].toMap());
+
+            qint32 existing = loaded.value(row["peerHandle"].toLongLong(), -1);
+            if (existing != -1) {
+                if (m_dialogs[existing]["photoId"] == row["photoId"]) {
+                    row["avatar"] = m_dialogs[existing]["avatar"];
+                }
 
-    beginInsertRows(QModelIndex(), m_dialogs.size(), m_dialogs.size() + dialogsRows.size() - 1);
-    m_dialogs.append(dialogsRows);
-    endInsertRows();
+                QVector<int> roles = changedRoles(m_dialogs[existing], row);
+                m_dialogs[existing] = row;
+                if (!roles.isEmpty()) {
+                    emit dataChanged(index(existing), index(existing), roles);
+                }
+                continue;
+            }
+
+            if (row["pinned"].toBool() && row["folderId"].toInt() == 0) {
+                m_lastPinnedIndex = qMax(m_lastPinnedIndex, m_dialogs.size() + rows.size());
+            }
+
+            rows.append(row);
+        }
+
+        if (!rows.isEmpty()) {
+            beginInsertRows(QModelIndex(), m_dialogs.size(), m_dialogs.size() + rows.size() - 1);
+            m_dialogs.append(rows);
+            endInsertRows();
+        }
+
+        if (page == 0) {
+            StartupTimeline::instance()->mark("first_dialog_row");
+        }
+    }
 
     if (m_avatarDownloader) {
         for (qint32 i = 0; i < usersList.size(); ++i) {
@@ -321,19 +653,108 @@ void DialogsModel::messagesGetDialogsResponse(TgObject data, TgLongVariant messa
         }
     }
 
-    if (canFetchMoreDownwards()) {
-        fetchMoreDownwards();
+    if (page == PEER_DIALOGS_PAGE) {
+        return;
+    }
+
+    if (canFetchMoreDownwards(page)) {
+        fetchMoreDownwards(page);
+    } else if (refreshing && m_pages[0].offsets.isEmpty()) {
+        finishRefresh();
+    }
+}
+
+void DialogsModel::finishRefresh()
+{
+    TRACE_SPAN_ARG("DialogsModel::finishRefresh", "rows", m_refreshRows.size());
+
+    QHash<qint64, qint32> current;
+    for (qint32 i = 0; i < m_dialogs.size(); ++i) {
+        current.insert(m_dialogs[i]["peerHandle"].toLongLong(), i);
+    }
+
+    //Rows a live update moved on top after their page was fetched, by on-screen position
+    QMap<qint32, TgObject> updated;
+
+    QList<TgObject> next;
+    next.reserve(m_refreshRows.size());
+    for (qint32 i = 0; i < m_refreshRows.size(); ++i) {
+        TgObject refreshedRow = m_refreshRows[i];
+
+        QHash<qint64, qint32>::const_iterator found = current.constFind(refreshedRow["peerHandle"].toLongLong());
+        if (found != current.constEnd()) {
+            const TgObject &row = m_dialogs[found.value()];
+
+            if (row["topMessage"].toInt() > refreshedRow["topMessage"].toInt()) {
+                if (!row["pinned"].toBool()) {
+                    updated.insert(found.value(), row);
+                    continue;
+                }
+                refreshedRow = row;
+            } else if (row["photoId"] == refreshedRow["photoId"]) {
+                //Keep the downloaded avatar instead of going back to the placeholder
+                refreshedRow["avatar"] = row["avatar"];
+            }
+        }
+
+        next.append(refreshedRow);
+    }
+
+    //Right after the pinned rows, as gotUpdate() placed them
+    qint32 firstUnpinned = 0;
+    while (firstUnpinned < next.size() && next[firstUnpinned]["pinned"].toBool()) {
+        ++firstUnpinned;
+    }
+    QList<TgObject> moved = updated.values();
+    for (qint32 i = 0; i < moved.size(); ++i) {
+        next.insert(firstUnpinned + i, moved[i]);
+    }
+
+    //Only the main list is refreshed, rows of other opened folders stay behind it
+    QSet<qint64> refreshed;
+    for (qint32 i = 0; i < next.size(); ++i) {
+        refreshed.insert(next[i]["peerHandle"].toLongLong());
+    }
+    for (qint32 i = 0; i < m_dialogs.size(); ++i) {
+        if (m_dialogs[i]["folderId"].toInt() != 0 && !refreshed.contains(m_dialogs[i]["peerHandle"].toLongLong())) {
+            next.append(m_dialogs[i]);
+        }
+    }
+
+    m_refreshing = false;
+    m_refreshRows.clear();
+
+    updateRows(m_dialogs, next, "peerHandle");
+
+    m_lastPinnedIndex = -1;
+    for (qint32 i = 0; i < m_dialogs.size(); ++i) {
+        if (m_dialogs[i]["pinned"].toBool() && m_dialogs[i]["folderId"].toInt() == 0) {
+            m_lastPinnedIndex = i;
+        }
     }
 }
 
+QVector<int> DialogsModel::changedRoles(const TgObject &before, const TgObject &after) const
+{
+    QVector<int> roles = DiffListModel::changedRoles(before, after);
+
+    //Formatted from messageDate on read
+    if (before["messageDate"] != after["messageDate"]) {
+        roles << MessageTimeRole;
+    }
+
+    return roles;
+}
+
 void DialogsModel::handleDialogMessage(TgObject &row, TgObject message, TgObject messageSender, TgList users, TgList chats)
 {
-    //TODO 12-hour format
-    row["messageTime"] = QDateTime::fromTime_t(qMax(message["date"].toInt(), message["edit_date"].toInt())).toString("hh:mm");
+    //Formatted on read by TimeFormatter, see data()
+    row["messageDate"] = qMax(message["date"].toInt(), message["edit_date"].toInt());
 
     QString messageSenderName;
 
     row["messageOut"] = message["out"].toBool();
+    row["topMessage"] = message["id"].toInt();
 
     if (message["out"].toBool()) {
         if (ID(message["action"].toMap()) != 0) {
@@ -345,6 +766,11 @@ void DialogsModel::handleDialogMessage(TgObject &row, TgObject message, TgObject
         messageSenderName = messageSender["title"].toString();
     }
 
+    //Plain name for notifications, empty when the dialog peer wrote the message itself
+    bool ownMessage = peerHandle(messageSender) == row["peerHandle"].toLongLong();
+    row["notificationSenderName"] = ownMessage ? QString() : messageSenderName;
+    row["notificationService"] = ID(message["action"].toMap()) != 0;
+
     if (!messageSenderName.isEmpty()) {
         if (ID(message["action"].toMap()) == 0) {
             messageSenderName += ": ";
@@ -374,16 +800,22 @@ void DialogsModel::handleDialogMessage(TgObject &row, TgObject message, TgObject
 
 TgObject DialogsModel::createRow(TgObject dialog, TgObject peer, TgObject message, TgObject messageSender, QList<TgObject> folders, TgList users, TgList chats)
 {
+    TRACE_SPAN("DialogsModel::createRow");
     TgObject row;
 
-    row["peer"] = peer;
     row["pinned"] = dialog["pinned"].toBool();
     row["silent"] = dialog["notify_settings"].toMap()["silent"].toBool();
+    row["muteUntil"] = dialog["notify_settings"].toMap()["mute_until"].toInt();
+    row["unreadCount"] = dialog["unread_count"].toInt();
+    row["folderId"] = dialog["folder_id"].toInt();
 
+    //The same shared map lives in the peer registry (registered when the row is applied),
+    //QML only passes the handle around
     TgObject inputPeer = peer;
     inputPeer.unite(dialog);
     ID_PROPERTY(inputPeer) = ID_PROPERTY(peer);
-    row["peerBytes"] = qSerialize(inputPeer);
+    row["peer"] = inputPeer;
+    row["peerHandle"] = peerHandle(inputPeer);
 
     TgList dialogFolders;
 
@@ -412,9 +844,12 @@ TgObject DialogsModel::createRow(TgObject dialog, TgObject peer, TgObject messag
         row["tooltip"] = tooltip;
     }
 
+    //Searched along with the title, see DialogsProxyModel
+    row["username"] = peer["username"].toString();
+
     row["thumbnailColor"] = AvatarDownloader::userColor(peer["id"].toLongLong());
     row["thumbnailText"] = AvatarDownloader::getAvatarText(row["title"].toString());
-    row["avatar"] = "";
+    row["avatar"] = AvatarDownloader::avatarPlaceholder(peer);
     row["photoId"] = peer["photo"].toMap()["photo_id"];
 
     handleDialogMessage(row, message, messageSender, users, chats);
@@ -424,7 +859,13 @@ TgObject DialogsModel::createRow(TgObject dialog, TgObject peer, TgObject messag
 
 void DialogsModel::avatarDownloaded(TgLongVariant photoId, QString filePath)
 {
-    QMutexLocker lock(&m_mutex);
+    StartupTimeline::instance()->mark("first_avatar_ready");
+
+    for (qint32 i = 0; i < m_refreshRows.size(); ++i) {
+        if (m_refreshRows[i]["photoId"] == photoId) {
+            m_refreshRows[i]["avatar"] = filePath;
+        }
+    }
 
     for (qint32 i = 0; i < m_dialogs.size(); ++i) {
         TgObject dialog = m_dialogs[i];
@@ -443,14 +884,24 @@ void DialogsModel::avatarDownloaded(TgLongVariant photoId, QString filePath)
 
 void DialogsModel::refresh()
 {
-    resetState();
+    if (m_dialogs.isEmpty()) {
+        resetState();
+        fetchMoreDownwards();
+        return;
+    }
+
+    //Rows stay on screen while the new list is fetched, see finishRefresh()
+    m_pages[0].requestId = 0;
+    m_pages[0].offsets = TgObject();
+    m_pages[0].offsets["_start"] = true;
+    m_refreshing = true;
+    m_refreshRows.clear();
+
     fetchMoreDownwards();
 }
 
 bool DialogsModel::inFolder(qint32 index, qint32 folderIndex)
 {
-    QMutexLocker lock(&m_mutex);
-
     if (!m_folders || index < 0 || folderIndex < 0)
         return true;
 
@@ -460,12 +911,9 @@ bool DialogsModel::inFolder(qint32 index, qint32 folderIndex)
 void DialogsModel::gotMessageUpdate(TgObject update, TgLongVariant messageId)
 {
     Q_UNUSED(messageId);
-    QMutexLocker lock(&m_mutex);
-
 
-
-
-    if (!m_offsets.isEmpty()) {
+    //Rows of a background refresh stay on screen and are patched, see finishRefresh()
+    if (!m_refreshing && !m_pages.value(0).offsets.isEmpty()) {
         return;
     }
 
@@ -555,12 +1003,12 @@ void DialogsModel::gotMessageUpdate(TgObject update, TgLongVariant messageId)
 
 void DialogsModel::gotUpdate(TgObject update, TgLongVariant messageId, TgList users, TgList chats, qint32 date, qint32 seq, qint32 seqStart)
 {
+    TRACE_SPAN_ARG("DialogsModel::gotUpdate", "type", ID(update));
     Q_UNUSED(messageId);
     Q_UNUSED(date)
     Q_UNUSED(seq)
     Q_UNUSED(seqStart)
 
-    QMutexLocker lock(&m_mutex);
     if(!m_client) {
         return;
     }
@@ -572,7 +1020,8 @@ void DialogsModel::gotUpdate(TgObject update, TgLongVariant messageId, TgList us
     case TLType::UpdateNewMessage:
     case TLType::UpdateNewChannelMessage:
     {
-        if (!m_offsets.isEmpty()) {
+        //Rows of a background refresh stay on screen and are patched, see finishRefresh()
+        if (!m_refreshing && !m_pages.value(0).offsets.isEmpty()) {
             return;
         }
 
@@ -614,6 +1063,10 @@ void DialogsModel::gotUpdate(TgObject update, TgLongVariant messageId, TgList us
 
         message["out"] = TgClient::getPeerId(sender) == m_client->getUserId();
 
+        if (!message["out"].toBool()) {
+            m_dialogs[rowIndex]["unreadCount"] = m_dialogs[rowIndex]["unreadCount"].toInt() + 1;
+        }
+
         handleDialogMessage(m_dialogs[rowIndex], message, sender, users, chats);
         emit dataChanged(index(rowIndex), index(rowIndex));
 
@@ -630,17 +1083,82 @@ void DialogsModel::gotUpdate(TgObject update, TgLongVariant messageId, TgList us
 
         break;
     }
+    case TLType::UpdateFolderPeers:
+    {
+        //Archived or unarchived, views filtering by folderId pick the row up
+        TgList folderPeers = update["folder_peers"].toList();
+        for (qint32 j = 0; j < folderPeers.size(); ++j) {
+            TgObject folderPeer = folderPeers[j].toMap();
+            qint64 handle = peerHandle(folderPeer["peer"].toMap());
+
+            for (qint32 i = 0; i < m_dialogs.size(); ++i) {
+                if (m_dialogs[i]["peerHandle"].toLongLong() != handle) {
+                    continue;
+                }
+
+                TgObject peer = m_dialogs[i]["peer"].toMap();
+                peer["folder_id"] = folderPeer["folder_id"];
+                m_dialogs[i]["peer"] = peer;
+                m_dialogs[i]["folderId"] = folderPeer["folder_id"].toInt();
+                registerPeer(peer);
+
+                emit dataChanged(index(i), index(i), QVector<int>() << FolderIdRole);
+                break;
+            }
+        }
+
+        break;
     }
+    case TLType::UpdateNotifySettings:
+    {
+        //Only per-peer settings are tracked, NotifyUsers/NotifyChats defaults are not
+        TgObject notifyPeer = update["peer"].toMap();
+        if (ID(notifyPeer) != TLType::NotifyPeer) {
+            return;
+        }
+
+        TgObject peer = notifyPeer["peer"].toMap();
+        TgObject settings = update["notify_settings"].toMap();
+
+        for (qint32 i = 0; i < m_dialogs.size(); ++i) {
+            if (!TgClient::peersEqual(m_dialogs[i]["peer"].toMap(), peer)) {
+                continue;
+            }
+
+            m_dialogs[i]["silent"] = settings["silent"].toBool();
+            m_dialogs[i]["muteUntil"] = settings["mute_until"].toInt();
+
+            emit notifySettingsChanged(m_dialogs[i]["peerHandle"].toLongLong(), isMuted(m_dialogs[i]));
+            break;
+        }
+
+        break;
+    }
+    }
+}
+
+bool DialogsModel::isMuted(TgObject row)
+{
+    return row["silent"].toBool() || row["muteUntil"].toLongLong() > QDateTime::currentMSecsSinceEpoch() / 1000;
 }
 
 void DialogsModel::prepareNotification(TgObject row)
 {
-    if (row["messageOut"].toBool())
+    //Muted peers never reach the notification stage
+    if (row["messageOut"].toBool() || isMuted(row))
         return;
 
-    emit sendNotification(TgClient::getPeerId(row["peer"].toMap()).toLongLong(),
+    //Service messages read as a sentence, "Alice joined the group"
+    QString senderName = row["notificationSenderName"].toString();
+    QString text = row["messageText"].toString();
+    if (row["notificationService"].toBool()) {
+        text = row["messageSenderName"].toString() + text;
+        senderName.clear();
+    }
+
+    emit sendNotification(row["peerHandle"].toLongLong(),
                           row["title"].toString(),
-                          row["messageSenderName"].toString(),
-                          row["messageText"].toString(),
+                          senderName,
+                          text,
                           row["silent"].toBool());
 }
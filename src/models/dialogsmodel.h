@@ -1,19 +1,25 @@
 #ifndef DIALOGSMODEL_H
 #define DIALOGSMODEL_H
 
-#include <QAbstractListModel>
 #include <QVariant>
-#include <QMutex>
 #include "tgclient.h"
 #include "avatardownloader.h"
 #include "foldersmodel.h"
+#include "memorystats.h"
+#include "ingestor.h"
+#include "difflistmodel.h"
+#include "readstatetracker.h"
+#include "updatessync.h"
 
-class DialogsModel : public QAbstractListModel
+class DialogsModel : public DiffListModel, public MemoryReporter
 {
     Q_OBJECT
     Q_PROPERTY(QObject* client READ client WRITE setClient)
     Q_PROPERTY(QObject* avatarDownloader READ avatarDownloader WRITE setAvatarDownloader)
     Q_PROPERTY(QObject* folders READ folders WRITE setFolders)
+    Q_PROPERTY(QObject* readState READ readState WRITE setReadState)
+    Q_PROPERTY(QObject* updates READ updates WRITE setUpdates)
+    Q_PROPERTY(bool loaded READ loaded NOTIFY loadedChanged)
 
 public:
     explicit DialogsModel(QObject *parent = 0);
@@ -31,47 +37,92 @@ public:
     void setFolders(QObject *model);
     QObject* folders() const;
 
+    void setReadState(QObject *tracker);
+    QObject* readState() const;
+
+    void setUpdates(QObject *sync);
+    QObject* updates() const;
+
+    //The first page of the main list arrived, it may have been empty
+    bool loaded() const;
+
     int rowCount(const QModelIndex& parent = QModelIndex()) const;
     QVariant data(const QModelIndex& index, int role = Qt::DisplayRole) const;
 
-    TgObject createRow(TgObject dialog, TgObject peer, TgObject message, TgObject messageSender, QList<TgObject> folders, TgList users, TgList chats);
-    void handleDialogMessage(TgObject &row, TgObject message, TgObject messageSender, TgList users, TgList chats);
+    static TgObject createRow(TgObject dialog, TgObject peer, TgObject message, TgObject messageSender, QList<TgObject> folders, TgList users, TgList chats);
+    static void handleDialogMessage(TgObject &row, TgObject message, TgObject messageSender, TgList users, TgList chats);
+    static TgObject buildDialogsBatch(TgObject data, QList<TgObject> folders, TgLongVariant requestId, qint32 page);
+    void applyDialogsBatch(TgObject batch);
+    void finishRefresh();
     void prepareNotification(TgObject row);
 
+    TgList memoryUsage() const;
+    static bool isMuted(TgObject row);
+
+protected:
+    QVector<int> changedRoles(const TgObject &before, const TgObject &after) const;
+
 signals:
-    void sendNotification(qint64 peerId, QString peerName, QString senderName, QString text, bool silent);
+    //Peers are identified by peerHandle(), user, chat and channel ids overlap
+    void sendNotification(qint64 peerHandle, QString peerName, QString senderName, QString text, bool silent);
+    void notifySettingsChanged(qint64 peerHandle, bool muted);
+    void loadedChanged();
 
 public slots:
     void authorized(TgLongVariant userId);
     void messagesGetDialogsResponse(TgObject data, TgLongVariant messageId);
+    void messagesGetPeerDialogsResponse(TgObject data, TgLongVariant messageId);
+    void applyBatches();
     void avatarDownloaded(TgLongVariant photoId, QString filePath);
 
     void refresh();
 
-    bool canFetchMoreDownwards() const;
-    void fetchMoreDownwards();
+    bool canFetchMoreDownwards(qint32 folderId = 0) const;
+    void fetchMoreDownwards(qint32 folderId = 0);
+
+    void loadFolder(qint32 folderId);
+    void loadFilter(qint32 folderIndex);
 
     void foldersChanged(QList<TgObject> folders);
+    void timeFormatChanged();
+    void readStateChanged(qint64 peer, qint32 maxId, qint32 readCount);
     bool inFolder(qint32 index, qint32 folderIndex);
 
     void gotUpdate(TgObject update, TgLongVariant messageId, TgList users, TgList chats, qint32 date, qint32 seq, qint32 seqStart);
     void gotMessageUpdate(TgObject update, TgLongVariant messageId);
 
 private:
-    QMutex m_mutex;
     QList<TgObject> m_dialogs;
 
     TgClient* m_client;
     TgLongVariant m_userId;
 
-    TgLongVariant m_requestId;
-    TgObject m_offsets;
+    //Paging of every folder that was opened so far, 0 is the main list and 1 the archive.
+    //Rows of all folders share m_dialogs.
+    struct FolderPage {
+        TgObject offsets;
+        TgLongVariant requestId;
+    };
+    QHash<qint32, FolderPage> m_pages;
+    //Filter selected while its predecessor's peer dialogs were loading, -1 if none
+    qint32 m_pendingFilter;
+
+    //Pages of a background refresh, merged into m_dialogs once complete
+    bool m_refreshing;
+    QList<TgObject> m_refreshRows;
+
+    bool m_loaded;
 
     AvatarDownloader* m_avatarDownloader;
 
     FoldersModel* m_folders;
     qint32 m_lastPinnedIndex;
 
+    ReadStateTracker* m_readState;
+    UpdatesSync* m_updates;
+
+    Ingestor* m_ingestor;
+
     enum DialogRoles {
         TitleRole = Qt::UserRole + 1,
         ThumbnailColorRole,
@@ -80,9 +131,12 @@ private:
         MessageTimeRole,
         MessageTextRole,
         TooltipRole,
-        PeerBytesRole,
+        PeerHandleRole,
         MessageSenderNameRole,
-        MessageSenderColorRole
+        MessageSenderColorRole,
+        UnreadCountRole,
+        FolderIdRole,
+        UsernameRole
     };
 
 };
@@ -0,0 +1,236 @@
+#include "dialogsproxymodel.h"
+
+#include "../searchindex.h"
+#include "../tracer.h"
+
+DialogsProxyModel::DialogsProxyModel(QObject *parent)
+    : QSortFilterProxyModel(parent)
+    , m_dialogs(nullptr)
+    , m_folderId(0)
+    , m_folderIndex(-1)
+    , m_folderIdRole(-1)
+    , m_peerHandleRole(-1)
+    , m_titleRole(-1)
+    , m_usernameRole(-1)
+    , m_index()
+    , m_query()
+    , m_queryTokens()
+    , m_matches()
+{
+    setDynamicSortFilter(true);
+}
+
+void DialogsProxyModel::setDialogs(QObject *model)
+{
+    DialogsModel* dialogs = dynamic_cast<DialogsModel*>(model);
+    if (!dialogs || dialogs == m_dialogs) {
+        return;
+    }
+
+    if (m_dialogs) {
+        m_dialogs->disconnect(this);
+    }
+
+    m_dialogs = dialogs;
+
+    QHash<int, QByteArray> roles = m_dialogs->roleNames();
+    m_folderIdRole = roles.key("folderId", -1);
+    m_peerHandleRole = roles.key("peerHandle", -1);
+    m_titleRole = roles.key("title", -1);
+    m_usernameRole = roles.key("username", -1);
+
+    //Connected before setSourceModel(), so the index is up to date when the proxy filters a change
+    connect(m_dialogs, SIGNAL(rowsInserted(QModelIndex,int,int)), this, SLOT(sourceRowsInserted(QModelIndex,int,int)));
+    connect(m_dialogs, SIGNAL(rowsAboutToBeRemoved(QModelIndex,int,int)), this, SLOT(sourceRowsAboutToBeRemoved(QModelIndex,int,int)));
+    connect(m_dialogs, SIGNAL(dataChanged(QModelIndex,QModelIndex,QVector<int>)), this, SLOT(sourceDataChanged(QModelIndex,QModelIndex,QVector<int>)));
+    connect(m_dialogs, SIGNAL(modelReset()), this, SLOT(sourceReset()));
+
+    sourceReset();
+    setSourceModel(m_dialogs);
+
+    load();
+}
+
+QObject* DialogsProxyModel::dialogs() const
+{
+    return m_dialogs;
+}
+
+void DialogsProxyModel::setFolderId(qint32 folderId)
+{
+    if (m_folderId == folderId) {
+        return;
+    }
+
+    m_folderId = folderId;
+    load();
+    invalidateFilter();
+
+    emit folderIdChanged();
+}
+
+qint32 DialogsProxyModel::folderId() const
+{
+    return m_folderId;
+}
+
+void DialogsProxyModel::setFolderIndex(qint32 folderIndex)
+{
+    if (m_folderIndex == folderIndex) {
+        return;
+    }
+
+    m_folderIndex = folderIndex;
+    load();
+    invalidateFilter();
+
+    emit folderIndexChanged();
+}
+
+qint32 DialogsProxyModel::folderIndex() const
+{
+    return m_folderIndex;
+}
+
+void DialogsProxyModel::setQuery(QString query)
+{
+    if (m_query == query) {
+        return;
+    }
+
+    TRACE_SPAN("DialogsProxyModel::setQuery");
+    m_query = query;
+
+    //Punctuation and case alone do not change the result
+    QStringList tokens = SearchIndex::tokenize(query);
+    if (tokens != m_queryTokens) {
+        m_queryTokens = tokens;
+        m_matches = m_index.search(m_queryTokens);
+
+        if (m_queryTokens.isEmpty()) {
+            invalidateFilter();
+            sort(-1);
+        } else if (sortColumn() != 0) {
+            invalidateFilter();
+            sort(0);
+        } else {
+            invalidate();
+        }
+    }
+
+    emit queryChanged();
+}
+
+QString DialogsProxyModel::query() const
+{
+    return m_query;
+}
+
+void DialogsProxyModel::indexRow(int sourceRow)
+{
+    QModelIndex index = m_dialogs->index(sourceRow);
+    qint64 handle = index.data(m_peerHandleRole).toLongLong();
+
+    QStringList tokens = SearchIndex::tokenize(index.data(m_titleRole).toString());
+    tokens << SearchIndex::tokenize(index.data(m_usernameRole).toString());
+    tokens.removeDuplicates();
+    m_index.insert(handle, tokens);
+
+    if (m_queryTokens.isEmpty()) {
+        return;
+    }
+
+    qint32 score = PrefixIndex::score(tokens, m_queryTokens);
+    if (score > 0) {
+        m_matches.insert(handle, score);
+    } else {
+        m_matches.remove(handle);
+    }
+}
+
+void DialogsProxyModel::sourceRowsInserted(const QModelIndex &parent, int first, int last)
+{
+    Q_UNUSED(parent);
+
+    for (int i = first; i <= last; ++i) {
+        indexRow(i);
+    }
+}
+
+void DialogsProxyModel::sourceRowsAboutToBeRemoved(const QModelIndex &parent, int first, int last)
+{
+    Q_UNUSED(parent);
+
+    for (int i = first; i <= last; ++i) {
+        qint64 handle = m_dialogs->index(i).data(m_peerHandleRole).toLongLong();
+        m_index.remove(handle);
+        m_matches.remove(handle);
+    }
+}
+
+void DialogsProxyModel::sourceDataChanged(const QModelIndex &topLeft, const QModelIndex &bottomRight, const QVector<int> &roles)
+{
+    //Most changes are new messages and counters, only renames touch the index
+    if (!roles.isEmpty() && !roles.contains(m_titleRole) && !roles.contains(m_usernameRole)) {
+        return;
+    }
+
+    for (int i = topLeft.row(); i <= bottomRight.row(); ++i) {
+        indexRow(i);
+    }
+}
+
+void DialogsProxyModel::sourceReset()
+{
+    m_index.clear();
+    m_matches.clear();
+
+    for (int i = 0; i < m_dialogs->rowCount(); ++i) {
+        indexRow(i);
+    }
+}
+
+void DialogsProxyModel::load()
+{
+    if (!m_dialogs) {
+        return;
+    }
+
+    if (m_folderIndex >= 0) {
+        m_dialogs->loadFilter(m_folderIndex);
+    } else {
+        m_dialogs->loadFolder(m_folderId);
+    }
+}
+
+bool DialogsProxyModel::filterAcceptsRow(int sourceRow, const QModelIndex &sourceParent) const
+{
+    Q_UNUSED(sourceParent);
+
+    if (!m_dialogs) {
+        return false;
+    }
+
+    if (!m_queryTokens.isEmpty()) {
+        return m_matches.contains(m_dialogs->index(sourceRow).data(m_peerHandleRole).toLongLong());
+    }
+
+    //Dialog filters decide about archived chats on their own
+    if (m_folderIndex >= 0) {
+        return m_dialogs->inFolder(sourceRow, m_folderIndex);
+    }
+
+    return m_dialogs->index(sourceRow).data(m_folderIdRole).toInt() == m_folderId;
+}
+
+bool DialogsProxyModel::lessThan(const QModelIndex &left, const QModelIndex &right) const
+{
+    //Only sorted while searching, ties keep the order of the dialog list
+    qint32 leftScore = m_matches.value(left.data(m_peerHandleRole).toLongLong());
+    qint32 rightScore = m_matches.value(right.data(m_peerHandleRole).toLongLong());
+    if (leftScore != rightScore) {
+        return leftScore > rightScore;
+    }
+
+    return left.row() < right.row();
+}
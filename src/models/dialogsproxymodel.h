@@ -0,0 +1,71 @@
+#ifndef DIALOGSPROXYMODEL_H
+#define DIALOGSPROXYMODEL_H
+
+#include <QSortFilterProxyModel>
+#include "dialogsmodel.h"
+#include "prefixindex.h"
+
+//One folder of the shared DialogsModel rows: the main list, the archive or a
+//dialog filter. Opening a folder is what makes DialogsModel load it.
+//With a query set, loaded chats of every folder whose title or username has a
+//token starting with each query token are shown instead, best matches first.
+class DialogsProxyModel : public QSortFilterProxyModel
+{
+    Q_OBJECT
+    Q_PROPERTY(QObject* dialogs READ dialogs WRITE setDialogs)
+    Q_PROPERTY(qint32 folderId READ folderId WRITE setFolderId NOTIFY folderIdChanged)
+    Q_PROPERTY(qint32 folderIndex READ folderIndex WRITE setFolderIndex NOTIFY folderIndexChanged)
+    Q_PROPERTY(QString query READ query WRITE setQuery NOTIFY queryChanged)
+
+public:
+    explicit DialogsProxyModel(QObject *parent = 0);
+
+    void setDialogs(QObject *model);
+    QObject* dialogs() const;
+
+    //Telegram folder id, 0 is the main list and 1 the archive
+    void setFolderId(qint32 folderId);
+    qint32 folderId() const;
+
+    //Index in FoldersModel, -1 shows the folder given by folderId
+    void setFolderIndex(qint32 folderIndex);
+    qint32 folderIndex() const;
+
+    void setQuery(QString query);
+    QString query() const;
+
+signals:
+    void folderIdChanged();
+    void folderIndexChanged();
+    void queryChanged();
+
+private slots:
+    void sourceRowsInserted(const QModelIndex &parent, int first, int last);
+    void sourceRowsAboutToBeRemoved(const QModelIndex &parent, int first, int last);
+    void sourceDataChanged(const QModelIndex &topLeft, const QModelIndex &bottomRight, const QVector<int> &roles);
+    void sourceReset();
+
+protected:
+    bool filterAcceptsRow(int sourceRow, const QModelIndex &sourceParent) const;
+    bool lessThan(const QModelIndex &left, const QModelIndex &right) const;
+
+private:
+    DialogsModel* m_dialogs;
+    qint32 m_folderId;
+    qint32 m_folderIndex;
+    int m_folderIdRole;
+    int m_peerHandleRole;
+    int m_titleRole;
+    int m_usernameRole;
+
+    //Keyed by peer handle, so moved rows keep their entry
+    PrefixIndex m_index;
+    QString m_query;
+    QStringList m_queryTokens;
+    QHash<qint64, qint32> m_matches;
+
+    void load();
+    void indexRow(int sourceRow);
+};
+
+#endif // DIALOGSPROXYMODEL_H
@@ -0,0 +1,110 @@
+#include "difflistmodel.h"
+
+#include <QSet>
+#include "../tracer.h"
+
+DiffListModel::DiffListModel(QObject *parent)
+    : QAbstractListModel(parent)
+{
+}
+
+QVector<int> DiffListModel::changedRoles(const TgObject &before, const TgObject &after) const
+{
+    QHash<int, QByteArray> roles = roleNames();
+    QVector<int> changed;
+
+    for (QHash<int, QByteArray>::const_iterator i = roles.constBegin(); i != roles.constEnd(); ++i) {
+        QString name = QString::fromLatin1(i.value());
+        if (before.value(name) != after.value(name)) {
+            changed << i.key();
+        }
+    }
+
+    return changed;
+}
+
+void DiffListModel::updateRows(QList<TgObject> &rows, const QList<TgObject> &next, const QString &key)
+{
+    TRACE_SPAN_ARG("DiffListModel::updateRows", "rows", next.size());
+
+    QSet<QString> nextKeys;
+    for (qint32 i = 0; i < next.size(); ++i) {
+        nextKeys.insert(next[i][key].toString());
+    }
+
+    //Removed rows first, a contiguous run at a time
+    for (qint32 i = rows.size() - 1; i >= 0; --i) {
+        if (nextKeys.contains(rows[i][key].toString())) {
+            continue;
+        }
+
+        qint32 last = i;
+        while (i > 0 && !nextKeys.contains(rows[i - 1][key].toString())) {
+            --i;
+        }
+
+        beginRemoveRows(QModelIndex(), i, last);
+        for (qint32 j = last; j >= i; --j) {
+            rows.removeAt(j);
+        }
+        endRemoveRows();
+    }
+
+    //What is left is a subset of next, walk it in the new order
+    QSet<QString> knownKeys;
+    for (qint32 i = 0; i < rows.size(); ++i) {
+        knownKeys.insert(rows[i][key].toString());
+    }
+
+    for (qint32 i = 0; i < next.size(); ++i) {
+        QString nextKey = next[i][key].toString();
+
+        if (!knownKeys.contains(nextKey)) {
+            //New rows, inserted together with the new ones right after them
+            qint32 last = i;
+            while (last + 1 < next.size() && !knownKeys.contains(next[last + 1][key].toString())) {
+                ++last;
+            }
+
+            beginInsertRows(QModelIndex(), i, last);
+            for (qint32 j = i; j <= last; ++j) {
+                rows.insert(j, next[j]);
+            }
+            endInsertRows();
+
+            i = last;
+            continue;
+        }
+
+        if (i >= rows.size() || rows[i][key].toString() != nextKey) {
+            qint32 from = i + 1;
+            while (from < rows.size() && rows[from][key].toString() != nextKey) {
+                ++from;
+            }
+
+            //A key repeated in next, keep it as a separate row
+            if (from >= rows.size()) {
+                beginInsertRows(QModelIndex(), i, i);
+                rows.insert(i, next[i]);
+                endInsertRows();
+                continue;
+            }
+
+            beginMoveRows(QModelIndex(), from, from, QModelIndex(), i);
+            rows.move(from, i);
+            endMoveRows();
+        }
+
+        if (rows[i] == next[i]) {
+            continue;
+        }
+
+        QVector<int> roles = changedRoles(rows[i], next[i]);
+        rows[i] = next[i];
+
+        //Keys without a role (peer, folders) need no signal
+        if (!roles.isEmpty()) {
+            emit dataChanged(index(i), index(i), roles);
+        }
+    }
+}
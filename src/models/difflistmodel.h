@@ -0,0 +1,24 @@
+#ifndef DIFFLISTMODEL_H
+#define DIFFLISTMODEL_H
+
+#include <QAbstractListModel>
+#include <QVector>
+#include "tgclient.h"
+
+//List model of TgObject rows which can be brought to a freshly fetched state in
+//place: rows are matched by a key, and only the needed remove, move, insert and
+//role-scoped dataChanged signals are emitted, so delegates and the scroll
+//position survive a refresh.
+class DiffListModel : public QAbstractListModel
+{
+public:
+    explicit DiffListModel(QObject *parent = 0);
+
+protected:
+    void updateRows(QList<TgObject> &rows, const QList<TgObject> &next, const QString &key);
+
+    //Roles affected by a row change, by default every role named like a changed key
+    virtual QVector<int> changedRoles(const TgObject &before, const TgObject &after) const;
+};
+
+#endif // DIFFLISTMODEL_H
@@ -2,14 +2,17 @@
 
 #include "tlschema.h"
 #include <QMutexLocker>
+#include "startuptimeline.h"
+#include "tracer.h"
 
 FoldersModel::FoldersModel(QObject *parent)
-    : QAbstractListModel(parent)
+    : DiffListModel(parent)
     , m_mutex(QMutex::Recursive)
     , m_folders()
     , m_client(nullptr)
     , m_userId(0)
     , m_requestId(0)
+    , m_refreshing(false)
 {
 }
 
@@ -30,6 +33,7 @@ void FoldersModel::resetState()
     }
 
     m_requestId = 0;
+    m_refreshing = false;
 }
 
 QHash<int, QByteArray> FoldersModel::roleNames() const
@@ -106,6 +110,7 @@ void FoldersModel::fetchMoreDownwards()
     QMutexLocker lock(&m_mutex);
 
     m_requestId = m_client->messagesGetDialogFilters();
+    TRACE_REQUEST_ISSUED("messages.getDialogFilters", m_requestId.toLongLong());
 }
 
 void FoldersModel::authorized(TgLongVariant userId)
@@ -128,10 +133,8 @@ void FoldersModel::messagesGetDialogFiltersResponse(TgVector data, TgLongVariant
     }
 
     m_requestId = 0;
-
-    if (data.isEmpty()) {
-        return;
-    }
+    StartupTimeline::instance()->mark("folders_first_response");
+    TRACE_REQUEST_FINISHED("messages.getDialogFilters", messageId.toLongLong());
 
     QList<TgObject> rows;
     rows.reserve(data.size());
@@ -140,6 +143,19 @@ void FoldersModel::messagesGetDialogFiltersResponse(TgVector data, TgLongVariant
         rows.append(createRow(data[i].toMap()));
     }
 
+    if (m_refreshing) {
+        m_refreshing = false;
+
+        //Filters are matched by id, the default one has none and stays unique
+        updateRows(m_folders, rows, "id");
+        emit foldersChanged(m_folders);
+        return;
+    }
+
+    if (rows.isEmpty()) {
+        return;
+    }
+
     beginInsertRows(QModelIndex(), m_folders.size(), m_folders.size() + rows.size() - 1);
     m_folders.append(rows);
     endInsertRows();
@@ -303,7 +319,16 @@ bool FoldersModel::matchesFilter(TgObject filter, TgObject peer)
 
 void FoldersModel::refresh()
 {
-    resetState();
+    QMutexLocker lock(&m_mutex);
+
+    if (m_folders.isEmpty()) {
+        resetState();
+        fetchMoreDownwards();
+        return;
+    }
+
+    //Folders stay as they are until the new list arrives
+    m_refreshing = true;
     fetchMoreDownwards();
 }
 
@@ -1,12 +1,12 @@
 #ifndef FOLDERSMODEL_H
 #define FOLDERSMODEL_H
 
-#include <QAbstractListModel>
 #include <QVariant>
 #include <QMutex>
 #include "tgclient.h"
+#include "difflistmodel.h"
 
-class FoldersModel : public QAbstractListModel
+class FoldersModel : public DiffListModel
 {
     Q_OBJECT
     Q_PROPERTY(QObject* client READ client WRITE setClient)
@@ -49,6 +49,7 @@ private:
     TgLongVariant m_userId;
 
     TgLongVariant m_requestId;
+    bool m_refreshing;
 
     enum FolderRoles {
         TitleRole = Qt::UserRole + 1,
@@ -0,0 +1,75 @@
+#include "ingestor.h"
+
+#include <QCoreApplication>
+#include <QThread>
+#include <QEvent>
+
+//Posted to the worker for every job, the worker drains all queued jobs at once
+static const QEvent::Type PROCESS_EVENT = QEvent::Type(QEvent::User + 1);
+
+QThread* Ingestor::ingestionThread()
+{
+    static QThread* thread = 0;
+
+    if (!thread) {
+        thread = new QThread();
+        thread->setObjectName("ingestion");
+        QObject::connect(QCoreApplication::instance(), SIGNAL(aboutToQuit()), thread, SLOT(quit()));
+        thread->start();
+    }
+
+    return thread;
+}
+
+Ingestor::Ingestor(QObject *parent)
+    : QObject(parent)
+    , m_queues(new IngestionQueues())
+    , m_worker(new IngestionWorker(m_queues))
+{
+    m_worker->moveToThread(ingestionThread());
+    connect(m_worker, SIGNAL(processed()), this, SIGNAL(batchesReady()), Qt::QueuedConnection);
+}
+
+Ingestor::~Ingestor()
+{
+    //Pending jobs are dropped with the worker, the queues live until it is gone
+    m_worker->disconnect(this);
+    m_worker->deleteLater();
+}
+
+void Ingestor::post(IngestionJob job)
+{
+    m_queues->jobs.push(job);
+    QCoreApplication::postEvent(m_worker, new QEvent(PROCESS_EVENT));
+}
+
+bool Ingestor::takeBatch(TgObject &batch)
+{
+    return m_queues->batches.pop(batch);
+}
+
+IngestionWorker::IngestionWorker(QSharedPointer<IngestionQueues> queues)
+    : QObject()
+    , m_queues(queues)
+{
+}
+
+bool IngestionWorker::event(QEvent *event)
+{
+    if (event->type() != PROCESS_EVENT) {
+        return QObject::event(event);
+    }
+
+    IngestionJob job;
+    bool produced = false;
+    while (m_queues->jobs.pop(job)) {
+        m_queues->batches.push(job());
+        produced = true;
+    }
+
+    if (produced) {
+        emit processed();
+    }
+
+    return true;
+}
@@ -0,0 +1,59 @@
+#ifndef INGESTOR_H
+#define INGESTOR_H
+
+#include <QObject>
+#include <QSharedPointer>
+#include <functional>
+#include "tgclient.h"
+#include "spscqueue.h"
+
+typedef std::function<TgObject()> IngestionJob;
+
+struct IngestionQueues {
+    SpscQueue<IngestionJob> jobs;
+    SpscQueue<TgObject> batches;
+};
+
+//Lives on the ingestion thread and runs the jobs of one Ingestor
+class IngestionWorker : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit IngestionWorker(QSharedPointer<IngestionQueues> queues);
+    bool event(QEvent *event);
+
+signals:
+    void processed();
+
+private:
+    QSharedPointer<IngestionQueues> m_queues;
+};
+
+//Turns raw TL responses into ready-made row batches off the GUI thread.
+//A model posts jobs, they run in order on the shared ingestion thread, and the
+//resulting batches come back through a lock-free queue; batchesReady() is
+//delivered on the model's thread, which takes them with takeBatch().
+//Jobs must not touch model state, they only get what they capture by value.
+class Ingestor : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit Ingestor(QObject *parent = 0);
+    virtual ~Ingestor();
+
+    void post(IngestionJob job);
+    bool takeBatch(TgObject &batch);
+
+    static QThread* ingestionThread();
+
+signals:
+    void batchesReady();
+
+private:
+    QSharedPointer<IngestionQueues> m_queues;
+    IngestionWorker* m_worker;
+};
+
+#endif // INGESTOR_H
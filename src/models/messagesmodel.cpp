@@ -1,7 +1,6 @@
 #include "messagesmodel.h"
 
 #include "tlschema.h"
-#include <QMutexLocker>
 #include <QColor>
 #include <QDateTime>
 #include <QUrl>
@@ -9,14 +8,42 @@
 #include "avatardownloader.h"
 #include "../messageutil.h"
 #include <QStandardPaths>
+#include <qmath.h>
+#include <QDataStream>
+#include <QThreadPool>
+#include <QFileInfo>
+#include "../mediapreparer.h"
+#include "../tracer.h"
+#include "../timeformatter.h"
+#include "../searchindex.h"
 
 using namespace TLType;
 
-#define BATCH_SIZE 40
+//Telegram does not return more than 100 messages per messages.getHistory
+#define MIN_BATCH_SIZE 10
+#define MAX_BATCH_SIZE 100
+#define DEFAULT_VIEWPORT_ROWS 10
+#define DEFAULT_RTT_MS 500
+
+#define DEFAULT_MATERIALIZED_ROWS 120
+#define DEFAULT_MAX_ROWS 1000
+
+#define UPLOAD_PHOTO_SIZE 1280
+#define UPLOAD_PHOTO_QUALITY 87
+
+#define DEFAULT_CACHED_PEERS 5
+//A cached chat which missed more updates than that is dropped and loaded from scratch
+#define MAX_PENDING_UPDATES 200
+
+//Row keys that stay uncompressed in compacted rows, because they are used for
+//merging, lookups and avatar/photo updates across the whole history.
+static const char* const HOT_ROW_KEYS[] = {
+    "messageId", "date", "messageDate", "grouped_id", "sender", "senderKey", "photoFileId", "photoFile", "out"
+};
 
 MessagesModel::MessagesModel(QObject *parent)
     : QAbstractListModel(parent)
-    , m_mutex(QMutex::Recursive)
+    , MemoryReporter("MessagesModel")
     , m_history()
     , m_client(nullptr)
     , m_userId(0)
@@ -26,12 +53,91 @@ MessagesModel::MessagesModel(QObject *parent)
     , m_downRequestId(0)
     , m_upOffset(0)
     , m_downOffset(0)
+    , m_upLimit(0)
+    , m_downLimit(0)
+    , m_upRequestTimer()
+    , m_downRequestTimer()
+    , m_viewportRows(0)
+    , m_scrollVelocity(0)
+    , m_minBatchSize(MIN_BATCH_SIZE)
+    , m_maxBatchSize(MAX_BATCH_SIZE)
+    , m_averageRtt(0)
+    , m_viewportIndex(-1)
+    , m_windowCenter(-1)
+    , m_materializedRows(DEFAULT_MATERIALIZED_ROWS)
+    , m_maxRows(DEFAULT_MAX_ROWS)
+    , m_expandedKey()
+    , m_expandedRow()
+    , m_cachedStates()
+    , m_cachedPeers(DEFAULT_CACHED_PEERS)
+    , m_senders()
+    , m_ingestor(new Ingestor(this))
     , m_avatarDownloader(nullptr)
-    , m_downloadRequests()
+    , m_downloadManager(nullptr)
+    , m_readState(nullptr)
+    , m_updates(nullptr)
+    , m_readMaxId(0)
     , m_uploadId(0)
+    , m_preparing(false)
+    , m_prepareToken(0)
+    , m_preparedFilePath()
     , m_sentMessages()
     , m_media()
 {
+    connect(m_ingestor, SIGNAL(batchesReady()), this, SLOT(applyBatches()));
+    connect(TimeFormatter::instance(), SIGNAL(changed()), this, SLOT(timeFormatChanged()));
+}
+
+void MessagesModel::timeFormatChanged()
+{
+    if (m_history.isEmpty()) {
+        return;
+    }
+
+    emit dataChanged(index(0), index(m_history.size() - 1), QVector<int>() << MessageTimeRole);
+}
+
+TgList MessagesModel::memoryUsage() const
+{
+    qint64 historyBytes = 0;
+    qint64 compactRows = 0;
+    qint64 compactBytes = 0;
+    for (qint32 i = 0; i < m_history.size(); ++i) {
+        qint64 size = MemoryStats::objectSize(m_history[i]);
+        historyBytes += size;
+
+        if (m_history[i].contains("_compact")) {
+            ++compactRows;
+            compactBytes += size;
+        }
+    }
+
+    qint64 cachedRows = 0;
+    qint64 cachedBytes = 0;
+    for (qint32 i = 0; i < m_cachedStates.size(); ++i) {
+        const HistoryState &state = m_cachedStates[i];
+        cachedRows += state.history.size();
+
+        for (qint32 j = 0; j < state.history.size(); ++j) {
+            cachedBytes += MemoryStats::objectSize(state.history[j]);
+        }
+        for (qint32 j = 0; j < state.pendingUpdates.size(); ++j) {
+            cachedBytes += MemoryStats::objectSize(state.pendingUpdates[j]);
+        }
+    }
+
+    TgList usage;
+    usage << MemoryStats::usage("history", m_history.size(), historyBytes);
+    usage << MemoryStats::usage("compactRows", compactRows, compactBytes);
+    usage << MemoryStats::usage("cachedPeers", m_cachedStates.size(), 0);
+    usage << MemoryStats::usage("cachedHistory", cachedRows, cachedBytes);
+
+    qint64 sendersBytes = 0;
+    for (QHash<qint64, SenderPresentation>::const_iterator i = m_senders.constBegin(); i != m_senders.constEnd(); ++i) {
+        sendersBytes += sizeof(SenderPresentation) + (i->name.size() + i->initials.size() + i->avatar.size()) * sizeof(QChar);
+    }
+    usage << MemoryStats::usage("senders", m_senders.size(), sendersBytes);
+    return usage;
 }
 
 MessagesModel::~MessagesModel()
@@ -90,6 +196,12 @@ void MessagesModel::resetState()
     m_downRequestId = 0;
     m_upOffset = 0;
     m_downOffset = 0;
+    m_upLimit = 0;
+    m_downLimit = 0;
+    m_scrollVelocity = 0;
+    m_viewportIndex = -1;
+    m_windowCenter = -1;
+    m_readMaxId = 0;
 }
 
 void MessagesModel::setClient(QObject *client)
@@ -98,8 +210,6 @@ void MessagesModel::setClient(QObject *client)
         return;
     }
 
-    QMutexLocker lock(&m_mutex);
-
     if (m_client) {
         m_client->disconnect(this);
     }
@@ -108,6 +218,7 @@ void MessagesModel::setClient(QObject *client)
     m_userId = 0;
 
     resetState();
+    clearCachedStates();
     cancelUpload();
 
     if (!m_client) {
@@ -116,13 +227,19 @@ void MessagesModel::setClient(QObject *client)
 
     connect(m_client, SIGNAL(authorized(TgLongVariant)), this, SLOT(authorized(TgLongVariant)));
     connect(m_client, SIGNAL(messagesMessagesResponse(TgObject,TgLongVariant)), this, SLOT(messagesGetHistoryResponse(TgObject,TgLongVariant)));
-    connect(m_client, SIGNAL(fileDownloaded(TgLongVariant,QString)), this, SLOT(fileDownloaded(TgLongVariant,QString)));
-    connect(m_client, SIGNAL(fileDownloadCanceled(TgLongVariant,QString)), this, SLOT(fileDownloadCanceled(TgLongVariant,QString)));
     connect(m_client, SIGNAL(gotMessageUpdate(TgObject,TgLongVariant)), this, SLOT(gotMessageUpdate(TgObject,TgLongVariant)));
-    connect(m_client, SIGNAL(gotUpdate(TgObject,TgLongVariant,TgList,TgList,qint32,qint32,qint32)), this, SLOT(gotUpdate(TgObject,TgLongVariant,TgList,TgList,qint32,qint32,qint32)));
+    //With an UpdatesSync set, live updates come from it in order
+    if (!m_updates) {
+        connect(m_client, SIGNAL(gotUpdate(TgObject,TgLongVariant,TgList,TgList,qint32,qint32,qint32)), this, SLOT(gotUpdate(TgObject,TgLongVariant,TgList,TgList,qint32,qint32,qint32)));
+    }
     connect(m_client, SIGNAL(fileUploading(TgLongVariant,TgLongVariant,TgLongVariant,qint32)), this, SLOT(fileUploading(TgLongVariant,TgLongVariant,TgLongVariant,qint32)));
     connect(m_client, SIGNAL(fileUploaded(TgLongVariant,TgObject)), this, SLOT(fileUploaded(TgLongVariant,TgObject)));
     connect(m_client, SIGNAL(fileUploadCanceled(TgLongVariant)), this, SLOT(fileUploadCanceled(TgLongVariant)));
+
+    //Restored session, authorized() may have been emitted before this model existed
+    if (m_client->getUserId().toLongLong()) {
+        openSearchIndex(m_client->getUserId());
+    }
 }
 
 QObject* MessagesModel::client() const
@@ -136,8 +253,6 @@ void MessagesModel::setAvatarDownloader(QObject *avatarDownloader)
         return;
     }
 
-    QMutexLocker lock(&m_mutex);
-
     if (m_avatarDownloader) {
         m_avatarDownloader->disconnect(this);
     }
@@ -150,6 +265,7 @@ void MessagesModel::setAvatarDownloader(QObject *avatarDownloader)
 
     connect(m_avatarDownloader, SIGNAL(avatarDownloaded(TgLongVariant,QString)), this, SLOT(avatarDownloaded(TgLongVariant,QString)));
     connect(m_avatarDownloader, SIGNAL(photoDownloaded(TgLongVariant,QString)), this, SLOT(photoDownloaded(TgLongVariant,QString)));
+    connect(m_avatarDownloader, SIGNAL(fullPhotoDownloaded(TgLongVariant,QString)), this, SLOT(fullPhotoDownloaded(TgLongVariant,QString)));
 }
 
 QObject* MessagesModel::avatarDownloader() const
@@ -157,25 +273,446 @@ QObject* MessagesModel::avatarDownloader() const
     return m_avatarDownloader;
 }
 
-void MessagesModel::setPeer(QByteArray bytes)
+void MessagesModel::setDownloadManager(QObject *manager)
+{
+    if(!manager) {
+        return;
+    }
+
+    if (m_downloadManager) {
+        m_downloadManager->disconnect(this);
+    }
+
+    m_downloadManager = dynamic_cast<DownloadManager*>(manager);
+
+    if (!m_downloadManager) {
+        return;
+    }
+
+    connect(m_downloadManager, SIGNAL(downloadStarted(qint64,qint32)), this, SLOT(downloadStarted(qint64,qint32)));
+    connect(m_downloadManager, SIGNAL(downloadProgress(qint64,qint32,qint64,qint64)), this, SLOT(downloadReceived(qint64,qint32,qint64,qint64)));
+    connect(m_downloadManager, SIGNAL(downloadFinished(qint64,qint32,QString)), this, SLOT(downloadFinished(qint64,qint32,QString)));
+    connect(m_downloadManager, SIGNAL(downloadCanceled(qint64,qint32)), this, SLOT(downloadCanceled(qint64,qint32)));
+}
+
+QObject* MessagesModel::downloadManager() const
+{
+    return m_downloadManager;
+}
+
+void MessagesModel::setReadState(QObject *tracker)
+{
+    m_readState = dynamic_cast<ReadStateTracker*>(tracker);
+}
+
+QObject* MessagesModel::readState() const
+{
+    return m_readState;
+}
+
+void MessagesModel::setUpdates(QObject *sync)
+{
+    if (m_updates) {
+        m_updates->disconnect(this);
+    }
+
+    m_updates = dynamic_cast<UpdatesSync*>(sync);
+    if (!m_updates) {
+        return;
+    }
+
+    if (m_client) {
+        disconnect(m_client, SIGNAL(gotUpdate(TgObject,TgLongVariant,TgList,TgList,qint32,qint32,qint32)), this, SLOT(gotUpdate(TgObject,TgLongVariant,TgList,TgList,qint32,qint32,qint32)));
+    }
+
+    //Sequenced live updates and the ones missed while disconnected are replayed the same way
+    connect(m_updates, SIGNAL(gotUpdate(TgObject,TgLongVariant,TgList,TgList,qint32,qint32,qint32)), this, SLOT(gotUpdate(TgObject,TgLongVariant,TgList,TgList,qint32,qint32,qint32)));
+}
+
+QObject* MessagesModel::updates() const
+{
+    return m_updates;
+}
+
+void MessagesModel::setPeer(qint64 handle)
 {
-    QMutexLocker lock(&m_mutex);
+    TgObject peer = registeredPeer(handle);
 
+    saveState();
     resetState();
-    m_downloadRequests.clear();
+    cancelUpload();
 
-    m_peer = qDeserialize(bytes).toMap();
+    if (restoreState(peer)) {
+        return;
+    }
+
+    m_peer = peer;
     m_inputPeer = TgClient::toInputPeer(m_peer);
-    cancelUpload();
 
     m_upOffset = m_downOffset = qMax(m_peer["read_inbox_max_id"].toInt(), m_peer["read_outbox_max_id"].toInt());
     fetchMoreUpwards();
     fetchMoreDownwards();
 }
 
-QByteArray MessagesModel::peer() const
+qint64 MessagesModel::peer() const
+{
+    return peerHandle(m_peer);
+}
+
+void MessagesModel::setViewportRows(qint32 rows)
+{
+    m_viewportRows = qMax(rows, 0);
+}
+
+qint32 MessagesModel::viewportRows() const
+{
+    return m_viewportRows;
+}
+
+void MessagesModel::setScrollVelocity(qreal rowsPerSecond)
+{
+    m_scrollVelocity = qAbs(rowsPerSecond);
+}
+
+qreal MessagesModel::scrollVelocity() const
 {
-    return qSerialize(m_peer);
+    return m_scrollVelocity;
+}
+
+void MessagesModel::setMinBatchSize(qint32 size)
+{
+    m_minBatchSize = qBound(1, size, MAX_BATCH_SIZE);
+    m_maxBatchSize = qMax(m_maxBatchSize, m_minBatchSize);
+}
+
+qint32 MessagesModel::minBatchSize() const
+{
+    return m_minBatchSize;
+}
+
+void MessagesModel::setMaxBatchSize(qint32 size)
+{
+    m_maxBatchSize = qBound(1, size, MAX_BATCH_SIZE);
+    m_minBatchSize = qMin(m_minBatchSize, m_maxBatchSize);
+}
+
+qint32 MessagesModel::maxBatchSize() const
+{
+    return m_maxBatchSize;
+}
+
+qint32 MessagesModel::nextBatchSize() const
+{
+    qint32 viewport = m_viewportRows > 0 ? m_viewportRows : DEFAULT_VIEWPORT_ROWS;
+
+    //First page of a freshly opened chat: just enough to fill the screen, so it arrives fast.
+    if (m_history.isEmpty()) {
+        return qBound(m_minBatchSize, viewport, m_maxBatchSize);
+    }
+
+    //Later pages: two screens plus whatever the user scrolls through while the request is in flight.
+    qreal rtt = (m_averageRtt > 0 ? m_averageRtt : DEFAULT_RTT_MS) / 1000.0;
+    qint32 size = viewport * 2 + qCeil(m_scrollVelocity * rtt * 2);
+
+    return qBound(m_minBatchSize, size, m_maxBatchSize);
+}
+
+void MessagesModel::updateAverageRtt(qint64 elapsed)
+{
+    if (m_averageRtt == 0) {
+        m_averageRtt = elapsed;
+    } else {
+        m_averageRtt = (m_averageRtt * 3 + elapsed) / 4;
+    }
+}
+
+void MessagesModel::setViewportIndex(qint32 index)
+{
+    if (index < 0) {
+        return;
+    }
+
+    m_viewportIndex = index;
+    updateWindow();
+    reportRead();
+}
+
+void MessagesModel::reportRead()
+{
+    if (!m_readState || m_history.isEmpty() || m_viewportIndex < 0) {
+        return;
+    }
+
+    qint64 handle = peerHandle(m_peer);
+    if (m_readMaxId == 0) {
+        //A restored chat may carry an outdated peer, the registry and the tracker know better
+        m_readMaxId = qMax(m_peer["read_inbox_max_id"].toInt(), registeredPeer(handle)["read_inbox_max_id"].toInt());
+        m_readMaxId = qMax(m_readMaxId, m_readState->readMaxId(handle));
+    }
+
+    //viewportIndex is the row in the middle of the screen, the newest one on screen is half a screen below
+    qint32 viewport = m_viewportRows > 0 ? m_viewportRows : DEFAULT_VIEWPORT_ROWS;
+    qint32 bottom = qMin(m_history.size() - 1, m_viewportIndex + viewport / 2);
+
+    qint32 maxId = m_history[bottom]["messageId"].toInt();
+    if (maxId <= m_readMaxId) {
+        return;
+    }
+
+    qint32 readCount = 0;
+    for (qint32 i = bottom; i >= 0; --i) {
+        if (m_history[i]["messageId"].toInt() <= m_readMaxId) {
+            break;
+        }
+        if (!m_history[i]["out"].toBool()) {
+            ++readCount;
+        }
+    }
+
+    m_readMaxId = maxId;
+    m_readState->markRead(m_peer, maxId, readCount);
+}
+
+qint32 MessagesModel::viewportIndex() const
+{
+    return m_viewportIndex;
+}
+
+void MessagesModel::setMaterializedRows(qint32 rows)
+{
+    m_materializedRows = qMax(rows, 1);
+    updateWindow(true);
+}
+
+qint32 MessagesModel::materializedRows() const
+{
+    return m_materializedRows;
+}
+
+void MessagesModel::setMaxRows(qint32 rows)
+{
+    //0 disables dropping, otherwise keep at least the materialized window
+    m_maxRows = rows <= 0 ? 0 : qMax(rows, m_materializedRows);
+    updateWindow(true);
+}
+
+qint32 MessagesModel::maxRows() const
+{
+    return m_maxRows;
+}
+
+TgObject MessagesModel::compactRow(TgObject row)
+{
+    if (row.contains("_compact")) {
+        return row;
+    }
+
+    TgObject compact;
+    for (quint32 i = 0; i < sizeof(HOT_ROW_KEYS) / sizeof(HOT_ROW_KEYS[0]); ++i) {
+        QString key = HOT_ROW_KEYS[i];
+        if (row.contains(key)) {
+            compact[key] = row.take(key);
+        }
+    }
+
+    QByteArray bytes;
+    QDataStream stream(&bytes, QIODevice::WriteOnly);
+    stream << row;
+    compact["_compact"] = qCompress(bytes);
+
+    return compact;
+}
+
+TgObject MessagesModel::expandRow(TgObject row)
+{
+    if (!row.contains("_compact")) {
+        return row;
+    }
+
+    TgObject expanded;
+    QByteArray bytes = qUncompress(row.take("_compact").toByteArray());
+    QDataStream stream(bytes);
+    stream >> expanded;
+
+    expanded.unite(row);
+    return expanded;
+}
+
+void MessagesModel::updateWindow(bool force)
+{
+    if (m_history.isEmpty()) {
+        return;
+    }
+
+    qint32 center = m_viewportIndex < 0 ? m_history.size() - 1 : qMin(m_viewportIndex, m_history.size() - 1);
+
+    if (!force && m_windowCenter != -1 && qAbs(center - m_windowCenter) < m_materializedRows / 4) {
+        return;
+    }
+
+    //Drop rows that are too far from the viewport, they will be fetched again on scroll.
+    //Never drop on a side with a request in flight, its offset is about to be overwritten.
+    if (m_maxRows > 0 && m_history.size() > m_maxRows) {
+        qint32 first = qBound(0, center - m_maxRows / 2, m_history.size() - m_maxRows);
+        qint32 last = first + m_maxRows - 1;
+
+        if (last < m_history.size() - 1 && !m_downRequestId.toLongLong()) {
+            m_downOffset = m_history[last]["messageId"].toInt();
+
+            beginRemoveRows(QModelIndex(), last + 1, m_history.size() - 1);
+            m_history.removeLast(m_history.size() - last - 1);
+            endRemoveRows();
+        }
+
+        if (first > 0 && !m_upRequestId.toLongLong()) {
+            m_upOffset = m_history[first]["messageId"].toInt();
+
+            beginRemoveRows(QModelIndex(), 0, first - 1);
+            m_history.removeFirst(first);
+            endRemoveRows();
+
+            center -= first;
+            if (m_viewportIndex != -1) {
+                m_viewportIndex = qMax(m_viewportIndex - first, 0);
+            }
+        }
+    }
+
+    m_windowCenter = center;
+
+    qint32 windowStart = center - m_materializedRows / 2;
+    qint32 windowEnd = center + m_materializedRows / 2;
+
+    for (qint32 i = 0; i < m_history.size(); ++i) {
+        bool compacted = m_history[i].contains("_compact");
+
+        if (i >= windowStart && i <= windowEnd) {
+            if (compacted) {
+                m_history[i] = expandRow(m_history[i]);
+            }
+        } else if (!compacted) {
+            m_history[i] = compactRow(m_history[i]);
+        }
+    }
+}
+
+void MessagesModel::setCachedPeers(qint32 count)
+{
+    m_cachedPeers = qMax(count, 0);
+    while (m_cachedStates.size() > m_cachedPeers) {
+        m_cachedStates.removeLast();
+    }
+}
+
+qint32 MessagesModel::cachedPeers() const
+{
+    return m_cachedPeers;
+}
+
+void MessagesModel::saveState()
+{
+    if (m_cachedPeers == 0 || TgClient::commonPeerType(m_inputPeer) == 0 || m_history.isEmpty()) {
+        return;
+    }
+
+    for (qint32 i = 0; i < m_cachedStates.size(); ++i) {
+        if (TgClient::peersEqual(m_cachedStates[i].peer, m_peer)) {
+            m_cachedStates.removeAt(i);
+            break;
+        }
+    }
+
+    HistoryState state;
+    state.peer = m_peer;
+    state.inputPeer = m_inputPeer;
+    state.upOffset = m_upOffset;
+    state.downOffset = m_downOffset;
+    state.viewportIndex = m_viewportIndex;
+
+    for (qint32 i = 0; i < m_history.size(); ++i) {
+        m_history[i] = compactRow(m_history[i]);
+    }
+    state.history = m_history;
+
+    m_cachedStates.prepend(state);
+    while (m_cachedStates.size() > m_cachedPeers) {
+        m_cachedStates.removeLast();
+    }
+}
+
+bool MessagesModel::restoreState(TgObject peer)
+{
+    qint32 stateIndex = -1;
+    for (qint32 i = 0; i < m_cachedStates.size(); ++i) {
+        if (TgClient::peersEqual(m_cachedStates[i].peer, peer)) {
+            stateIndex = i;
+            break;
+        }
+    }
+
+    if (stateIndex == -1) {
+        return false;
+    }
+
+    HistoryState state = m_cachedStates.takeAt(stateIndex);
+
+    m_peer = peer;
+    m_inputPeer = state.inputPeer;
+    m_upOffset = state.upOffset;
+    m_downOffset = state.downOffset;
+    m_viewportIndex = state.viewportIndex;
+
+    beginInsertRows(QModelIndex(), 0, state.history.size() - 1);
+    m_history = state.history;
+    endInsertRows();
+
+    updateWindow(true);
+
+    //Catch up with what happened while the chat was in background
+    for (qint32 i = 0; i < state.pendingUpdates.size(); ++i) {
+        TgObject pending = state.pendingUpdates[i];
+
+        if (pending["short"].toBool()) {
+            gotMessageUpdate(pending["update"].toMap(), 0);
+        } else {
+            gotUpdate(pending["update"].toMap(), 0, pending["users"].toList(), pending["chats"].toList(), 0, 0, 0);
+        }
+    }
+
+    //The page may not be connected to the model yet
+    qint32 anchor = m_viewportIndex != -1 ? m_viewportIndex : m_history.size() - 1;
+    QMetaObject::invokeMethod(this, "scrollTo", Qt::QueuedConnection, Q_ARG(qint32, anchor));
+
+    return true;
+}
+
+void MessagesModel::clearCachedStates()
+{
+    m_cachedStates.clear();
+}
+
+bool MessagesModel::queueCachedUpdate(TgObject peerId, TgObject pending)
+{
+    for (qint32 i = 0; i < m_cachedStates.size(); ++i) {
+        HistoryState &state = m_cachedStates[i];
+
+        //Updates without peer (deleted messages of users and chats) go to every non-channel state
+        if (TgClient::commonPeerType(peerId) == 0 ? TgClient::isChannel(state.peer) : !TgClient::peersEqual(state.peer, peerId)) {
+            continue;
+        }
+
+        if (state.pendingUpdates.size() >= MAX_PENDING_UPDATES) {
+            m_cachedStates.removeAt(i--);
+            continue;
+        }
+
+        state.pendingUpdates.append(pending);
+        if (TgClient::commonPeerType(peerId) != 0) {
+            return true;
+        }
+    }
+
+    return false;
 }
 
 int MessagesModel::rowCount(const QModelIndex &parent) const
@@ -214,7 +751,36 @@ QVariant MessagesModel::data(const QModelIndex &index, int role) const
         return false;
     }
 
-    return m_history[index.row()][roleNames()[role]];
+    if (role == MessageTimeRole) {
+        return TimeFormatter::instance()->messageTime(m_history[index.row()]["messageDate"].toInt());
+    }
+
+    switch (role) {
+    case SenderNameRole:
+        return m_senders.value(m_history[index.row()]["senderKey"].toLongLong()).name;
+    case ThumbnailColorRole:
+        return m_senders.value(m_history[index.row()]["senderKey"].toLongLong()).color;
+    case ThumbnailTextRole:
+        return m_senders.value(m_history[index.row()]["senderKey"].toLongLong()).initials;
+    case AvatarRole:
+        return m_senders.value(m_history[index.row()]["senderKey"].toLongLong()).avatar;
+    }
+
+    const TgObject &row = m_history[index.row()];
+    QString key = roleNames()[role];
+
+    if (!row.contains(key) && row.contains("_compact")) {
+        //A delegate reads every role of a row in a row, decompress it once.
+        //The cached blob is referenced, so its address can't be reused by another row.
+        QByteArray compact = row["_compact"].toByteArray();
+        if (compact.constData() != m_expandedKey.constData()) {
+            m_expandedKey = compact;
+            m_expandedRow = expandRow(row);
+        }
+        return m_expandedRow[key];
+    }
+
+    return row[key];
 }
 
 bool MessagesModel::canFetchMoreDownwards() const
@@ -232,9 +798,10 @@ void MessagesModel::fetchMoreDownwards()
         return;
     }
 
-    QMutexLocker lock(&m_mutex);
-
-    m_downRequestId = m_client->messagesGetHistory(m_inputPeer, m_downOffset, 0, -BATCH_SIZE, BATCH_SIZE);
+    m_downLimit = nextBatchSize();
+    m_downRequestTimer.start();
+    m_downRequestId = m_client->messagesGetHistory(m_inputPeer, m_downOffset, 0, -m_downLimit, m_downLimit);
+    TRACE_REQUEST_ISSUED("messages.getHistory", m_downRequestId.toLongLong());
 }
 
 bool MessagesModel::canFetchMoreUpwards() const
@@ -251,89 +818,157 @@ void MessagesModel::fetchMoreUpwards()
         return;
     }
 
-    QMutexLocker lock(&m_mutex);
-
-    m_upRequestId = m_client->messagesGetHistory(m_inputPeer, m_upOffset, 0, 0, BATCH_SIZE);
+    m_upLimit = nextBatchSize();
+    m_upRequestTimer.start();
+    m_upRequestId = m_client->messagesGetHistory(m_inputPeer, m_upOffset, 0, 0, m_upLimit);
+    TRACE_REQUEST_ISSUED("messages.getHistory", m_upRequestId.toLongLong());
 }
 
 void MessagesModel::authorized(TgLongVariant userId)
 {
-    QMutexLocker lock(&m_mutex);
-
     if (m_userId != userId) {
         resetState();
+        clearCachedStates();
         cancelUpload();
-        m_downloadRequests.clear();
+        m_senders.clear();
         m_userId = userId;
     }
+    openSearchIndex(userId);
     qDebug() << Q_FUNC_INFO;
 }
 
-void MessagesModel::messagesGetHistoryResponse(TgObject data, TgLongVariant messageId)
+void MessagesModel::openSearchIndex(TgLongVariant userId)
 {
-    QMutexLocker lock(&m_mutex);
+    SearchIndex::instance()->open(m_client->sessionDirectory().absoluteFilePath("Kutegram_search.idx"), userId.toLongLong());
+}
 
-    if (messageId == m_downRequestId) {
-        handleHistoryResponse(data, messageId);
-        m_downRequestId = 0;
+void MessagesModel::messagesGetHistoryResponse(TgObject data, TgLongVariant messageId)
+{
+    bool upwards = messageId == m_upRequestId;
+    if (messageId != m_downRequestId && !upwards) {
         return;
     }
 
-    if (messageId == m_upRequestId) {
-        handleHistoryResponseUpwards(data, messageId);
-        m_upRequestId = 0;
-        return;
-    }
+    TRACE_REQUEST_FINISHED("messages.getHistory", messageId.toLongLong());
+    updateAverageRtt(upwards ? m_upRequestTimer.elapsed() : m_downRequestTimer.elapsed());
+
+    //The request id stays set until the batch is applied, so no next page is requested before
+    TgObject peer = m_peer;
+    m_ingestor->post([data, peer, messageId, upwards]() {
+        TgObject batch = buildHistoryBatch(data, peer);
+        batch["requestId"] = messageId;
+        batch["upwards"] = upwards;
+        return batch;
+    });
 }
 
-void MessagesModel::handleHistoryResponse(TgObject data, TgLongVariant messageId)
+TgObject MessagesModel::buildHistoryBatch(TgObject data, TgObject peer)
 {
-    Q_UNUSED(messageId)
-
     TgList messages = data["messages"].toList();
+    TRACE_SPAN_ARG("MessagesModel::buildHistoryBatch", "messages", messages.size());
     TgList chats = data["chats"].toList();
     TgList users = data["users"].toList();
 
-    globalUsers().append(users);
-    globalChats().append(chats);
-
-    if (messages.isEmpty()) {
-        m_downOffset = -1;
-        return;
-    }
-
-    QList<TgObject> messagesRows;
-    messagesRows.reserve(messages.size());
+    TgList messagesRows;
+    TgList senders;
+    TgList searchDocuments;
+    qint64 handle = peerHandle(peer);
 
     for (qint32 i = messages.size() - 1; i >= 0; --i) {
         TgObject message = messages[i].toMap();
+        //Tokenized here, off the GUI thread
+        searchDocuments << SearchIndex::prepare(handle, message);
         TgObject fromId = message["from_id"].toMap();
         TgObject sender;
 
         if (TgClient::isUser(fromId)) for (qint32 j = 0; j < users.size(); ++j) {
-                TgObject peer = users[j].toMap();
-                if (TgClient::peersEqual(peer, fromId)) {
-                    sender = peer;
+                TgObject user = users[j].toMap();
+                if (TgClient::peersEqual(user, fromId)) {
+                    sender = user;
                     break;
                 }
             }
         if (TgClient::isChat(fromId)) for (qint32 j = 0; j < chats.size(); ++j) {
-                TgObject peer = chats[j].toMap();
-                if (TgClient::peersEqual(peer, fromId)) {
-                    sender = peer;
+                TgObject chat = chats[j].toMap();
+                if (TgClient::peersEqual(chat, fromId)) {
+                    sender = chat;
                     break;
                 }
             }
         if (TgClient::commonPeerType(fromId) == 0) {
-            sender = m_peer;
+            //This means that it is a channel feed or personal messages.
+            //Authorized user is returned by API, so we don't need to put it manually.
+            sender = peer;
         }
 
-        messagesRows.append(createRow(message, sender, users, chats));
+        messagesRows << buildRow(message, sender, users, chats);
+        senders << sender;
+    }
+
+    TgObject batch;
+    batch["rows"] = messagesRows;
+    batch["senders"] = senders;
+    batch["search"] = searchDocuments;
+    batch["users"] = users;
+    batch["chats"] = chats;
+    batch["firstId"] = messages.isEmpty() ? 0 : messages.first().toMap()["id"].toInt();
+    batch["lastId"] = messages.isEmpty() ? 0 : messages.last().toMap()["id"].toInt();
+
+    return batch;
+}
+
+void MessagesModel::applyBatches()
+{
+    TgObject batch;
+    while (m_ingestor->takeBatch(batch)) {
+        //Indexed even if the batch itself is dropped, the messages are valid anyway
+        SearchIndex::instance()->addDocuments(batch["search"].toList());
+
+        //Dropped by a peer switch or resetState() meanwhile
+        if (batch["upwards"].toBool() && batch["requestId"] == m_upRequestId) {
+            handleHistoryResponseUpwards(batch);
+            m_upRequestId = 0;
+        } else if (!batch["upwards"].toBool() && batch["requestId"] == m_downRequestId) {
+            handleHistoryResponse(batch);
+            m_downRequestId = 0;
+        }
+    }
+}
+
+QList<TgObject> MessagesModel::internBatch(TgObject batch)
+{
+    TgList rows = batch["rows"].toList();
+    TgList senders = batch["senders"].toList();
+
+    QList<TgObject> messagesRows;
+    messagesRows.reserve(rows.size());
+
+    for (qint32 i = 0; i < rows.size(); ++i) {
+        internSender(senders[i].toMap());
+        messagesRows.append(rows[i].toMap());
+    }
+
+    return messagesRows;
+}
+
+void MessagesModel::handleHistoryResponse(TgObject batch)
+{
+    TgList chats = batch["chats"].toList();
+    TgList users = batch["users"].toList();
+
+    globalUsers().append(users);
+    globalChats().append(chats);
+
+    QList<TgObject> messagesRows = internBatch(batch);
+
+    if (messagesRows.isEmpty()) {
+        m_downOffset = -1;
+        return;
     }
 
     qint32 oldOffset = m_downOffset;
-    qint32 newOffset = messages.first().toMap()["id"].toInt();
-    if (m_downOffset != newOffset && messages.size() == BATCH_SIZE) {
+    qint32 newOffset = batch["firstId"].toInt();
+    if (m_downOffset != newOffset && messagesRows.size() >= m_downLimit) {
         m_downOffset = newOffset;
     } else {
         m_downOffset = -1;
@@ -345,6 +980,7 @@ void MessagesModel::handleHistoryResponse(TgObject data, TgLongVariant messageId
     m_history.append(messagesRows);
     endInsertRows();
 
+    //Emitted before updateWindow(), which may evict rows from the top and shift these indices
     if (oldSize > 0) {
         emit dataChanged(index(oldSize - 1), index(oldSize - 1));
     }
@@ -354,6 +990,7 @@ void MessagesModel::handleHistoryResponse(TgObject data, TgLongVariant messageId
         emit scrollTo(m_history.size() - 1);
     }
 
+    updateWindow(true);
 
     if (m_avatarDownloader) {
         for (qint32 i = 0; i < users.size(); ++i) {
@@ -369,56 +1006,24 @@ void MessagesModel::handleHistoryResponse(TgObject data, TgLongVariant messageId
     }
 }
 
-void MessagesModel::handleHistoryResponseUpwards(TgObject data, TgLongVariant messageId)
+void MessagesModel::handleHistoryResponseUpwards(TgObject batch)
 {
-    Q_UNUSED(messageId)
-
-    TgList messages = data["messages"].toList();
-    TgList chats = data["chats"].toList();
-    TgList users = data["users"].toList();
+    TgList chats = batch["chats"].toList();
+    TgList users = batch["users"].toList();
 
     globalUsers().append(users);
     globalChats().append(chats);
 
-    if (messages.isEmpty()) {
+    QList<TgObject> messagesRows = internBatch(batch);
+
+    if (messagesRows.isEmpty()) {
         m_upOffset = -1;
         return;
     }
 
-    QList<TgObject> messagesRows;
-    messagesRows.reserve(messages.size());
-
-    for (qint32 i = messages.size() - 1; i >= 0; --i) {
-        TgObject message = messages[i].toMap();
-        TgObject fromId = message["from_id"].toMap();
-        TgObject sender;
-
-        if (TgClient::isUser(fromId)) for (qint32 j = 0; j < users.size(); ++j) {
-                TgObject peer = users[j].toMap();
-                if (TgClient::peersEqual(peer, fromId)) {
-                    sender = peer;
-                    break;
-                }
-            }
-        if (TgClient::isChat(fromId)) for (qint32 j = 0; j < chats.size(); ++j) {
-                TgObject peer = chats[j].toMap();
-                if (TgClient::peersEqual(peer, fromId)) {
-                    sender = peer;
-                    break;
-                }
-            }
-        if (TgClient::commonPeerType(fromId) == 0) {
-            //This means that it is a channel feed or personal messages.
-            //Authorized user is returned by API, so we don't need to put it manually.
-            sender = m_peer;
-        }
-
-        messagesRows.append(createRow(message, sender, users, chats));
-    }
-
     qint32 oldOffset = m_upOffset;
-    qint32 newOffset = messages.last().toMap()["id"].toInt();
-    if (m_upOffset != newOffset && messages.size() == BATCH_SIZE) {
+    qint32 newOffset = batch["lastId"].toInt();
+    if (m_upOffset != newOffset && messagesRows.size() >= m_upLimit) {
         m_upOffset = newOffset;
     } else {
         m_upOffset = -1;
@@ -427,13 +1032,21 @@ void MessagesModel::handleHistoryResponseUpwards(TgObject data, TgLongVariant me
     qint32 oldSize = m_history.size();
 
     beginInsertRows(QModelIndex(), 0, messagesRows.size() - 1);
-    m_history = messagesRows + m_history;
+    m_history.prepend(messagesRows);
     endInsertRows();
 
+    if (m_viewportIndex != -1) {
+        m_viewportIndex += messagesRows.size();
+    }
+
+    //Emitted before updateWindow(), which may evict the boundary row from the bottom
     if (oldSize > 0) {
         emit dataChanged(index(messagesRows.size()), index(messagesRows.size()));
     }
 
+    //Only the bottom can be evicted while this request is in flight, top indices stay valid
+    updateWindow(true);
+
     // aka it is the first time when history is loaded in chat
     if (qMax(m_peer["read_inbox_max_id"].toInt(), m_peer["read_outbox_max_id"].toInt()) == oldOffset) {
         emit scrollTo(m_history.size() - 1);
@@ -456,32 +1069,25 @@ void MessagesModel::handleHistoryResponseUpwards(TgObject data, TgLongVariant me
 
 TgObject MessagesModel::createRow(TgObject message, TgObject sender, TgList users, TgList chats)
 {
+    internSender(sender);
+    return buildRow(message, sender, users, chats);
+}
+
+TgObject MessagesModel::buildRow(TgObject message, TgObject sender, TgList users, TgList chats)
+{
+    TRACE_SPAN("MessagesModel::createRow");
     TgObject row;
     row["messageId"] = message["id"];
 
-    if (TgClient::isUser(sender)) {
-        row["senderName"] = QString(sender["first_name"].toString() + " " + sender["last_name"].toString());
-    } else {
-        row["senderName"] = sender["title"].toString();
-    }
-
     //TODO post author
-
-    row["thumbnailColor"] = AvatarDownloader::userColor(sender["id"].toLongLong());
-    row["thumbnailText"] = AvatarDownloader::getAvatarText(row["senderName"].toString());
-    row["avatar"] = "";
-    row["photoId"] = sender["photo"].toMap()["photo_id"];
-
-    row["senderName"] = QString("<html><span style=\"color: "
-                                + AvatarDownloader::userColor(sender["id"]).name()
-                                + "\">"
-                                + row["senderName"].toString()
-                                + "</span></html>");
+    //Sender presentation is interned on the GUI thread, see internSender()
+    row["senderKey"] = peerHandle(sender);
 
     row["date"] = message["date"];
     row["grouped_id"] = message["grouped_id"];
-    //TODO 12-hour format
-    row["messageTime"] = QDateTime::fromTime_t(qMax(message["date"].toInt(), message["edit_date"].toInt())).toString("hh:mm");
+    row["out"] = message["out"].toBool();
+    //Formatted on read by TimeFormatter, see data()
+    row["messageDate"] = qMax(message["date"].toInt(), message["edit_date"].toInt());
     //TODO replies support
     row["messageText"] = messageToHtml(message["message"].toString(), message["entities"].toList());
     row["sender"] = TgClient::toInputPeer(sender);
@@ -524,7 +1130,7 @@ TgObject MessagesModel::createRow(TgObject message, TgObject sender, TgList user
     case MessageMediaPhoto:
     {
         row["hasMedia"] = false;
-        row["photoFile"] = "";
+        row["photoFile"] = AvatarDownloader::photoPlaceholder(media["photo"].toMap());
         row["_photoToDownload"] = media["photo"].toMap();
         row["photoFileId"] = media["photo"].toMap()["id"].toLongLong();
         row["hasPhoto"] = row["photoFileId"].toLongLong() != 0;
@@ -647,12 +1253,12 @@ TgObject MessagesModel::createRow(TgObject message, TgObject sender, TgList user
 
 void MessagesModel::linkActivated(QString link, qint32 listIndex)
 {
-    QMutexLocker lock(&m_mutex);
-
-    QUrl url(link);
-    Q_UNUSED(link); //TODO
+    if (link.startsWith("kutegram://search/")) {
+        emit searchRequested(link.mid(18));
+        return;
+    }
 
-    TgObject listItem = m_history[listIndex];
+    TgObject listItem = expandRow(m_history[listIndex]);
     QDomDocument dom;
 
     if (!dom.setContent(listItem["messageText"].toString(), false)) {
@@ -695,28 +1301,88 @@ void MessagesModel::linkActivated(QString link, qint32 listIndex)
     qDebug() << "OPEN URL:" << link;
 }
 
-void MessagesModel::avatarDownloaded(TgLongVariant photoId, QString filePath)
+qint64 MessagesModel::internSender(TgObject sender)
 {
-    QMutexLocker lock(&m_mutex);
+    qint64 senderKey = peerHandle(sender);
 
-    for (qint32 i = 0; i < m_history.size(); ++i) {
-        TgObject message = m_history[i];
+    QString name;
+    if (TgClient::isUser(sender)) {
+        name = QString(sender["first_name"].toString() + " " + sender["last_name"].toString());
+    } else {
+        name = sender["title"].toString();
+    }
+
+    qint64 photoId = sender["photo"].toMap()["photo_id"].toLongLong();
+
+    QHash<qint64, SenderPresentation>::iterator i = m_senders.find(senderKey);
+    if (i == m_senders.end()) {
+        SenderPresentation presentation;
+        presentation.color = AvatarDownloader::userColor(sender["id"].toLongLong());
+        presentation.name = QString("<html><span style=\"color: " + presentation.color.name() + "\">" + name + "</span></html>");
+        presentation.initials = AvatarDownloader::getAvatarText(name);
+        presentation.avatar = AvatarDownloader::avatarPlaceholder(sender);
+        presentation.photoId = photoId;
+        m_senders.insert(senderKey, presentation);
+
+        return senderKey;
+    }
+
+    //Known sender, rows only need a refresh if something visible changed
+    QVector<int> roles;
+
+    QString htmlName = QString("<html><span style=\"color: " + i->color.name() + "\">" + name + "</span></html>");
+    if (i->name != htmlName) {
+        i->name = htmlName;
+        i->initials = AvatarDownloader::getAvatarText(name);
+        roles << SenderNameRole << ThumbnailTextRole;
+    }
+
+    if (i->photoId != photoId) {
+        i->photoId = photoId;
+        i->avatar = AvatarDownloader::avatarPlaceholder(sender);
+        roles << AvatarRole;
+    }
+
+    if (!roles.isEmpty()) {
+        senderChanged(senderKey, roles);
+    }
 
-        if (message["photoId"] != photoId) {
+    return senderKey;
+}
+
+void MessagesModel::senderChanged(qint64 senderKey, QVector<int> roles)
+{
+    //One dataChanged() per contiguous run of the sender's rows
+    qint32 first = -1;
+    for (qint32 i = 0; i <= m_history.size(); ++i) {
+        if (i < m_history.size() && m_history[i]["senderKey"].toLongLong() == senderKey) {
+            if (first == -1) {
+                first = i;
+            }
             continue;
         }
 
-        message["avatar"] = filePath;
-        m_history[i] = message;
+        if (first != -1) {
+            emit dataChanged(index(first), index(i - 1), roles);
+            first = -1;
+        }
+    }
+}
 
-        emit dataChanged(index(i), index(i));
+void MessagesModel::avatarDownloaded(TgLongVariant photoId, QString filePath)
+{
+    for (QHash<qint64, SenderPresentation>::iterator i = m_senders.begin(); i != m_senders.end(); ++i) {
+        if (i->photoId != photoId.toLongLong()) {
+            continue;
+        }
+
+        i->avatar = filePath;
+        senderChanged(i.key(), QVector<int>() << AvatarRole);
     }
 }
 
 void MessagesModel::photoDownloaded(TgLongVariant photoId, QString filePath)
 {
-    QMutexLocker lock(&m_mutex);
-
     for (qint32 i = 0; i < m_history.size(); ++i) {
         TgObject message = m_history[i];
 
@@ -731,19 +1397,35 @@ void MessagesModel::photoDownloaded(TgLongVariant photoId, QString filePath)
     }
 }
 
-void MessagesModel::downloadFile(qint32 index)
+void MessagesModel::fullPhotoDownloaded(TgLongVariant photoId, QString filePath)
 {
-    QMutexLocker lock(&m_mutex);
+    for (qint32 i = 0; i < m_history.size(); ++i) {
+        if (m_history[i]["photoFileId"] == photoId) {
+            emit photoOpened(m_history[i]["messageId"].toInt(), filePath);
+        }
+    }
+}
 
-    if (!m_client || !m_client->isAuthorized() || TgClient::commonPeerType(m_peer) == 0 || index == -1) {
+void MessagesModel::openPhoto(qint32 index)
+{
+    if (!m_avatarDownloader || index < 0 || index >= m_history.size()) {
         return;
     }
 
-    cancelDownload(index);
+    m_avatarDownloader->downloadFullPhoto(expandRow(m_history[index])["_photoToDownload"].toMap());
+}
+
+void MessagesModel::downloadFile(qint32 index)
+{
+    if (!m_client || !m_downloadManager || !m_client->isAuthorized() || TgClient::commonPeerType(m_peer) == 0 || index == -1) {
+        return;
+    }
 
     QDir::home().mkdir("Kutegram");
 
-    QString fileName = m_history[index]["mediaFileName"].toString();
+    TgObject row = expandRow(m_history[index]);
+
+    QString fileName = row["mediaFileName"].toString();
     if (fileName.isEmpty()) fileName = QString::number(QDateTime::currentDateTime().toMSecsSinceEpoch());
 
     QStringList split = fileName.split('.');
@@ -772,63 +1454,89 @@ void MessagesModel::downloadFile(qint32 index)
     QString indexedFilePath = dir.absoluteFilePath("Kutegram/" + indexedFileName);
     qint32 fileIndex = 0;
 
-    while (QFile(indexedFilePath).exists()) {
+    while (QFile(indexedFilePath).exists() || QFile(DownloadManager::partFilePath(indexedFilePath)).exists()) {
         ++fileIndex;
         indexedFileName = fileNameBefore + " (" + QString::number(fileIndex) + ")" + fileNameAfter;
         indexedFilePath = dir.absoluteFilePath("Kutegram/" + indexedFileName);
     }
 
-    qint32 messageId = m_history[index]["messageId"].toInt();
-    qint64 requestId = m_client->downloadFile(indexedFilePath, m_history[index]["mediaDownload"].toMap()).toLongLong();
-    m_downloadRequests.insert(requestId, messageId);
-    emit downloadUpdated(messageId, 0, "");
+    m_downloadManager->enqueue(peerHandle(m_peer), row["messageId"].toInt(), row["mediaDownload"].toMap(), indexedFilePath);
+    //Queued behind maxConcurrent downloads, show it as pending right away
+    emit downloadUpdated(row["messageId"].toInt(), 0, "");
 }
 
 void MessagesModel::cancelDownload(qint32 index)
 {
-    QMutexLocker lock(&m_mutex);
-
-    if (!m_client) {
+    if (!m_downloadManager || index < 0 || index >= m_history.size()) {
         return;
     }
 
     qint32 messageId = m_history[index]["messageId"].toInt();
-    qint64 requestId = m_downloadRequests.key(messageId);
-    m_downloadRequests.remove(requestId);
-    m_client->cancelDownload(requestId);
-    emit downloadUpdated(messageId, -1, "");
+    if (!m_downloadManager->find(peerHandle(m_peer), messageId)) {
+        //Nothing queued, still reset the delegate
+        emit downloadUpdated(messageId, -1, "");
+        return;
+    }
+
+    m_downloadManager->cancel(peerHandle(m_peer), messageId);
 }
 
-void MessagesModel::fileDownloaded(TgLongVariant fileId, QString filePath)
+void MessagesModel::downloadStarted(qint64 peer, qint32 messageId)
 {
-    QMutexLocker lock(&m_mutex);
+    if (peer != peerHandle(m_peer)) {
+        return;
+    }
 
-    TgVariant messageId = m_downloadRequests.take(fileId.toLongLong());
+    emit downloadUpdated(messageId, 0, "");
+}
 
-    if (messageId.isNull()) {
+void MessagesModel::downloadReceived(qint64 peer, qint32 messageId, qint64 received, qint64 total)
+{
+    if (peer != peerHandle(m_peer)) {
         return;
     }
 
-    emit downloadUpdated(messageId.toInt(), 1, "file:///" + filePath);
+    emit downloadProgress(messageId, received, total);
 }
 
-void MessagesModel::fileDownloadCanceled(TgLongVariant fileId, QString filePath)
+void MessagesModel::downloadFinished(qint64 peer, qint32 messageId, QString filePath)
 {
-    Q_UNUSED(filePath)
-    QMutexLocker lock(&m_mutex);
+    if (peer != peerHandle(m_peer)) {
+        return;
+    }
 
-    TgVariant messageId = m_downloadRequests.take(fileId.toLongLong());
+    emit downloadUpdated(messageId, 1, filePath);
+}
 
-    if (messageId.isNull()) {
+void MessagesModel::downloadCanceled(qint64 peer, qint32 messageId)
+{
+    if (peer != peerHandle(m_peer)) {
         return;
     }
 
-    emit downloadUpdated(messageId.toInt(), -1, "");
+    emit downloadUpdated(messageId, -1, "");
 }
 
 void MessagesModel::gotMessageUpdate(TgObject update, TgLongVariant messageId)
 {
-    QMutexLocker lock(&m_mutex);
+    if (ID(update) != TLType::UpdateShortSentMessage) {
+        TgObject updatePeer;
+        if (update["user_id"].toLongLong()) {
+            ID_PROPERTY(updatePeer) = TLType::PeerUser;
+            updatePeer["user_id"] = update["user_id"];
+        } else if (update["chat_id"].toLongLong()) {
+            ID_PROPERTY(updatePeer) = TLType::PeerChat;
+            updatePeer["chat_id"] = update["chat_id"];
+        }
+
+        if (TgClient::commonPeerType(updatePeer) != 0 && !TgClient::peersEqual(m_peer, updatePeer)) {
+            TgObject pending;
+            pending["short"] = true;
+            pending["update"] = update;
+            queueCachedUpdate(updatePeer, pending);
+            return;
+        }
+    }
 
     if (m_downOffset != -1) {
         return;
@@ -907,8 +1615,10 @@ void MessagesModel::gotMessageUpdate(TgObject update, TgLongVariant messageId)
 
     qint32 oldSize = m_history.size();
 
-    beginInsertRows(QModelIndex(), m_history.size(), m_history.size());
+    //Built first, interning the sender may emit dataChanged() for older rows
     TgObject messageRow = createRow(update, sender, globalUsers(), globalChats());
+
+    beginInsertRows(QModelIndex(), m_history.size(), m_history.size());
     m_history.append(messageRow);
     endInsertRows();
 
@@ -927,17 +1637,53 @@ void MessagesModel::gotMessageUpdate(TgObject update, TgLongVariant messageId)
 
 void MessagesModel::gotUpdate(TgObject update, TgLongVariant messageId, TgList users, TgList chats, qint32 date, qint32 seq, qint32 seqStart)
 {
+    TRACE_SPAN_ARG("MessagesModel::gotUpdate", "type", ID(update));
     Q_UNUSED(messageId);
     Q_UNUSED(date);
     Q_UNUSED(seq);
     Q_UNUSED(seqStart);
 
-    QMutexLocker lock(&m_mutex);
+    //Updates of every chat are indexed, not only of the open one
+    SearchIndex::instance()->gotUpdate(update);
 
     //We should avoid duplicates. (implement DB)
     //    _globalUsers.append(users);
     //    _globalChats.append(chats);
 
+    if (!m_cachedStates.isEmpty()) {
+        TgObject pending;
+        pending["update"] = update;
+        pending["users"] = users;
+        pending["chats"] = chats;
+
+        switch (ID(update)) {
+        case TLType::UpdateNewMessage:
+        case TLType::UpdateNewChannelMessage:
+        case TLType::UpdateEditMessage:
+        case TLType::UpdateEditChannelMessage:
+        {
+            TgObject peerId = update["message"].toMap()["peer_id"].toMap();
+            if (!TgClient::peersEqual(m_peer, peerId)) {
+                queueCachedUpdate(peerId, pending);
+            }
+            break;
+        }
+        case TLType::UpdateDeleteChannelMessages:
+        {
+            TgObject peerId;
+            ID_PROPERTY(peerId) = TLType::PeerChannel;
+            peerId["channel_id"] = update["channel_id"];
+            if (!TgClient::peersEqual(m_peer, peerId)) {
+                queueCachedUpdate(peerId, pending);
+            }
+            break;
+        }
+        case TLType::UpdateDeleteMessages:
+            queueCachedUpdate(TgObject(), pending);
+            break;
+        }
+    }
+
     switch (ID(update)) {
     case TLType::UpdateNewMessage:
     case TLType::UpdateNewChannelMessage:
@@ -978,8 +1724,10 @@ void MessagesModel::gotUpdate(TgObject update, TgLongVariant messageId, TgList u
 
         qint32 oldSize = m_history.size();
 
-        beginInsertRows(QModelIndex(), m_history.size(), m_history.size());
+        //Built first, interning the sender may emit dataChanged() for older rows
         TgObject messageRow = createRow(message, sender, users, chats);
+
+        beginInsertRows(QModelIndex(), m_history.size(), m_history.size());
         m_history.append(messageRow);
         endInsertRows();
 
@@ -1074,7 +1822,7 @@ void MessagesModel::gotUpdate(TgObject update, TgLongVariant messageId, TgList u
 
 void MessagesModel::sendMessage(QString message)
 {
-    if (!m_client || !m_client->isAuthorized() || TgClient::commonPeerType(m_inputPeer) == 0 || m_uploadId.toLongLong() || (message.isEmpty() && GETID(m_media["file"].toMap()) == 0)) {
+    if (!m_client || !m_client->isAuthorized() || TgClient::commonPeerType(m_inputPeer) == 0 || m_preparing || m_uploadId.toLongLong() || (message.isEmpty() && GETID(m_media["file"].toMap()) == 0)) {
         return;
     }
 
@@ -1082,7 +1830,7 @@ void MessagesModel::sendMessage(QString message)
     cancelUpload();
 }
 
-void MessagesModel::uploadFile()
+void MessagesModel::uploadFile(QString filePath)
 {
     if(!m_client) {
         return;
@@ -1090,36 +1838,67 @@ void MessagesModel::uploadFile()
 
     cancelUpload();
 
-//TODO: fixme
-    qWarning() << Q_FUNC_INFO << "NOT READY!";
-    QStringList selectedFiles = QStringList();
-    if (selectedFiles.isEmpty()) {
+    QString selected = filePath.startsWith("file:") ? QUrl(filePath).toLocalFile() : filePath;
+    if (selected.isEmpty() || !QFile::exists(selected)) {
         return;
     }
 
-    QString selected = selectedFiles.first();
-    if (selected.isEmpty()) {
+    if (MediaPreparer::isPhoto(selected)) {
+        ID_PROPERTY(m_media) = TLType::InputMediaUploadedPhoto;
+
+        //Camera photos are recompressed to a sane size on a worker thread first
+        QDir dir(QStandardPaths::writableLocation(QStandardPaths::CacheLocation));
+        dir.mkpath(".");
+
+        m_preparing = true;
+        QString targetPath = dir.absoluteFilePath("upload_" + QString::number(++m_prepareToken));
+
+        MediaPreparer* preparer = new MediaPreparer(m_prepareToken, selected, targetPath, UPLOAD_PHOTO_SIZE, UPLOAD_PHOTO_QUALITY);
+        connect(preparer, SIGNAL(prepared(qint64,QString)), this, SLOT(mediaPrepared(qint64,QString)), Qt::QueuedConnection);
+        QThreadPool::globalInstance()->start(preparer);
+
+        emit uploadingProgress(0);
         return;
     }
 
-    if (selected.endsWith(".jpg") || selected.endsWith(".jpeg") || selected.endsWith(".png")) {
-        ID_PROPERTY(m_media) = TLType::InputMediaUploadedPhoto;
-    } else {
-        ID_PROPERTY(m_media) = TLType::InputMediaUploadedDocument;
+    ID_PROPERTY(m_media) = TLType::InputMediaUploadedDocument;
 
-        TGOBJECT(TLType::DocumentAttributeFilename, fileName);
-        fileName["file_name"] = selected.split('/').last();
+    TGOBJECT(TLType::DocumentAttributeFilename, fileName);
+    fileName["file_name"] = QFileInfo(selected).fileName();
 
-        TgList attributes;
-        attributes << fileName;
-        m_media["attributes"] = attributes;
-    }
+    TgList attributes;
+    attributes << fileName;
+    m_media["attributes"] = attributes;
 
+    //The client reads the file part by part while uploading
     m_uploadId = m_client->uploadFile(selected);
 
     emit uploadingProgress(0);
 }
 
+void MessagesModel::mediaPrepared(qint64 token, QString filePath)
+{
+    if (token != m_prepareToken || !m_preparing) {
+        //Canceled meanwhile
+        if (!filePath.isEmpty()) {
+            QFile::remove(filePath);
+        }
+        return;
+    }
+
+    m_preparing = false;
+
+    //The suffix is only known once the image was read
+    m_preparedFilePath = filePath;
+
+    if (filePath.isEmpty() || !m_client) {
+        cancelUpload();
+        return;
+    }
+
+    m_uploadId = m_client->uploadFile(filePath);
+}
+
 void MessagesModel::cancelUpload()
 {
     if(!m_client) {
@@ -1132,9 +1911,20 @@ void MessagesModel::cancelUpload()
     }
     m_uploadId = 0;
 
+    m_preparing = false;
+    removePreparedFile();
+
     emit uploadingProgress(-1);
 }
 
+void MessagesModel::removePreparedFile()
+{
+    if (!m_preparedFilePath.isEmpty()) {
+        QFile::remove(m_preparedFilePath);
+        m_preparedFilePath.clear();
+    }
+}
+
 void MessagesModel::fileUploadCanceled(TgLongVariant fileId)
 {
     if (m_uploadId != fileId) {
@@ -1153,13 +1943,13 @@ void MessagesModel::fileUploaded(TgLongVariant fileId, TgObject inputFile)
 
     m_uploadId = 0;
     m_media["file"] = inputFile;
+    removePreparedFile();
 
     emit uploadingProgress(100);
 }
 
 void MessagesModel::fileUploading(TgLongVariant fileId, TgLongVariant processedLength, TgLongVariant totalLength, qint32 progressPercentage)
 {
-    Q_UNUSED(fileId);
     Q_UNUSED(processedLength);
     Q_UNUSED(totalLength);
 
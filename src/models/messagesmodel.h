@@ -3,16 +3,34 @@
 
 #include <QAbstractListModel>
 #include <QVariant>
-#include <QMutex>
+#include <QElapsedTimer>
+#include <QColor>
 #include "tgclient.h"
 #include "avatardownloader.h"
+#include "downloadmanager.h"
+#include "chunkedlist.h"
+#include "memorystats.h"
+#include "ingestor.h"
+#include "readstatetracker.h"
+#include "updatessync.h"
 
-class MessagesModel : public QAbstractListModel
+class MessagesModel : public QAbstractListModel, public MemoryReporter
 {
     Q_OBJECT
     Q_PROPERTY(QObject* client READ client WRITE setClient)
     Q_PROPERTY(QObject* avatarDownloader READ avatarDownloader WRITE setAvatarDownloader)
-    Q_PROPERTY(QByteArray peer READ peer WRITE setPeer)
+    Q_PROPERTY(QObject* downloadManager READ downloadManager WRITE setDownloadManager)
+    Q_PROPERTY(QObject* readState READ readState WRITE setReadState)
+    Q_PROPERTY(QObject* updates READ updates WRITE setUpdates)
+    Q_PROPERTY(qint64 peer READ peer WRITE setPeer)
+    Q_PROPERTY(qint32 viewportRows READ viewportRows WRITE setViewportRows)
+    Q_PROPERTY(qreal scrollVelocity READ scrollVelocity WRITE setScrollVelocity)
+    Q_PROPERTY(qint32 minBatchSize READ minBatchSize WRITE setMinBatchSize)
+    Q_PROPERTY(qint32 maxBatchSize READ maxBatchSize WRITE setMaxBatchSize)
+    Q_PROPERTY(qint32 viewportIndex READ viewportIndex WRITE setViewportIndex)
+    Q_PROPERTY(qint32 materializedRows READ materializedRows WRITE setMaterializedRows)
+    Q_PROPERTY(qint32 maxRows READ maxRows WRITE setMaxRows)
+    Q_PROPERTY(qint32 cachedPeers READ cachedPeers WRITE setCachedPeers)
 
 public:
     explicit MessagesModel(QObject *parent = 0);
@@ -27,40 +45,101 @@ public:
     void setAvatarDownloader(QObject *client);
     QObject* avatarDownloader() const;
 
-    void setPeer(QByteArray bytes);
-    QByteArray peer() const;
+    void setDownloadManager(QObject *manager);
+    QObject* downloadManager() const;
+
+    void setReadState(QObject *tracker);
+    QObject* readState() const;
+
+    void setUpdates(QObject *sync);
+    QObject* updates() const;
+
+    void setPeer(qint64 handle);
+    qint64 peer() const;
+
+    void setViewportRows(qint32 rows);
+    qint32 viewportRows() const;
+
+    void setScrollVelocity(qreal rowsPerSecond);
+    qreal scrollVelocity() const;
+
+    void setMinBatchSize(qint32 size);
+    qint32 minBatchSize() const;
+
+    void setMaxBatchSize(qint32 size);
+    qint32 maxBatchSize() const;
+
+    qint32 nextBatchSize() const;
+
+    void setViewportIndex(qint32 index);
+    qint32 viewportIndex() const;
+
+    void setMaterializedRows(qint32 rows);
+    qint32 materializedRows() const;
+
+    void setMaxRows(qint32 rows);
+    qint32 maxRows() const;
+
+    static TgObject compactRow(TgObject row);
+    static TgObject expandRow(TgObject row);
+    void updateWindow(bool force = false);
+
+    void setCachedPeers(qint32 count);
+    qint32 cachedPeers() const;
+
+    void saveState();
+    bool restoreState(TgObject peer);
+    void clearCachedStates();
+    bool queueCachedUpdate(TgObject peerId, TgObject pending);
+
+    void openSearchIndex(TgLongVariant userId);
 
     int rowCount(const QModelIndex& parent = QModelIndex()) const;
     QVariant data(const QModelIndex& index, int role = Qt::DisplayRole) const;
 
+    TgList memoryUsage() const;
+
     TgObject createRow(TgObject message, TgObject sender, TgList users, TgList chats);
+    static TgObject buildRow(TgObject message, TgObject sender, TgList users, TgList chats);
+    static TgObject buildHistoryBatch(TgObject data, TgObject peer);
 
-    void handleHistoryResponse(TgObject data, TgLongVariant messageId);
-    void handleHistoryResponseUpwards(TgObject data, TgLongVariant messageId);
+    void handleHistoryResponse(TgObject batch);
+    void handleHistoryResponseUpwards(TgObject batch);
+    QList<TgObject> internBatch(TgObject batch);
 
 signals:
     void scrollTo(qint32 index);
     void downloadUpdated(qint32 messageId, qint32 state, QString filePath);
+    void downloadProgress(qint32 messageId, qint64 received, qint64 total);
     void draftChanged(QString draft);
     void uploadingProgress(qint32 progress);
     void scrollForNew();
     void sentMessageUpdate(TgObject update, TgLongVariant messageId);
+    void photoOpened(qint32 messageId, QString filePath);
+    //A hashtag or cashtag was tapped
+    void searchRequested(QString query);
 
 public slots:
     void authorized(TgLongVariant userId);
+    void timeFormatChanged();
     void messagesGetHistoryResponse(TgObject data, TgLongVariant messageId);
+    void applyBatches();
     void avatarDownloaded(TgLongVariant photoId, QString filePath);
     void photoDownloaded(TgLongVariant photoId, QString filePath);
+    void fullPhotoDownloaded(TgLongVariant photoId, QString filePath);
 
-    void fileDownloaded(TgLongVariant fileId, QString filePath);
-    void fileDownloadCanceled(TgLongVariant fileId, QString filePath);
+    void downloadStarted(qint64 peer, qint32 messageId);
+    void downloadReceived(qint64 peer, qint32 messageId, qint64 received, qint64 total);
+    void downloadFinished(qint64 peer, qint32 messageId, QString filePath);
+    void downloadCanceled(qint64 peer, qint32 messageId);
 
     void fileUploading(TgLongVariant fileId, TgLongVariant processedLength, TgLongVariant totalLength, qint32 progressPercentage);
     void fileUploaded(TgLongVariant fileId, TgObject inputFile);
     void fileUploadCanceled(TgLongVariant fileId);
 
     void sendMessage(QString message);
-    void uploadFile();
+    void uploadFile(QString filePath);
+    void mediaPrepared(qint64 token, QString filePath);
     void cancelUpload();
 
     void gotMessageUpdate(TgObject update, TgLongVariant messageId);
@@ -75,10 +154,10 @@ public slots:
     void linkActivated(QString link, qint32 index);
     void downloadFile(qint32 index);
     void cancelDownload(qint32 index);
+    void openPhoto(qint32 index);
 
 private:
-    QMutex m_mutex;
-    QList<TgObject> m_history;
+    ChunkedList<TgObject> m_history;
 
     TgClient* m_client;
     TgLongVariant m_userId;
@@ -92,11 +171,70 @@ private:
     qint32 m_upOffset;
     qint32 m_downOffset;
 
+    qint32 m_upLimit;
+    qint32 m_downLimit;
+    QElapsedTimer m_upRequestTimer;
+    QElapsedTimer m_downRequestTimer;
+
+    qint32 m_viewportRows;
+    qreal m_scrollVelocity;
+    qint32 m_minBatchSize;
+    qint32 m_maxBatchSize;
+    qint64 m_averageRtt;
+
+    void updateAverageRtt(qint64 elapsed);
+
+    qint32 m_viewportIndex;
+    qint32 m_windowCenter;
+    qint32 m_materializedRows;
+    qint32 m_maxRows;
+    //Last compacted row expanded by data(), keyed by its compressed blob
+    mutable QByteArray m_expandedKey;
+    mutable TgObject m_expandedRow;
+
+    //History of a recently opened chat, kept to restore it instantly on switch back
+    struct HistoryState {
+        TgObject peer;
+        TgObject inputPeer;
+        ChunkedList<TgObject> history;
+        qint32 upOffset;
+        qint32 downOffset;
+        qint32 viewportIndex;
+        QList<TgObject> pendingUpdates;
+    };
+
+    QList<HistoryState> m_cachedStates;
+    qint32 m_cachedPeers;
+
+    //Presentation of a message sender, shared by all of its rows through row["senderKey"]
+    struct SenderPresentation {
+        QString name;
+        QColor color;
+        QString initials;
+        QString avatar;
+        qint64 photoId;
+    };
+
+    QHash<qint64, SenderPresentation> m_senders;
+    qint64 internSender(TgObject sender);
+    void senderChanged(qint64 senderKey, QVector<int> roles);
+
+    Ingestor* m_ingestor;
+
     AvatarDownloader* m_avatarDownloader;
 
-    QHash<qint64, TgVariant> m_downloadRequests;
+    DownloadManager* m_downloadManager;
+
+    ReadStateTracker* m_readState;
+    UpdatesSync* m_updates;
+    qint32 m_readMaxId;
+    void reportRead();
 
     TgLongVariant m_uploadId;
+    bool m_preparing;
+    qint64 m_prepareToken;
+    QString m_preparedFilePath;
+    void removePreparedFile();
     QHash<TgLong, QString> m_sentMessages;
     TgObject m_media;
 
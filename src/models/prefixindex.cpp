@@ -0,0 +1,133 @@
+#include "prefixindex.h"
+
+#include <algorithm>
+
+#define EXACT_SCORE 2
+#define PREFIX_SCORE 1
+#define FIRST_TOKEN_BONUS 1
+
+PrefixIndex::PrefixIndex()
+    : m_tokens()
+    , m_postings()
+{
+}
+
+void PrefixIndex::insert(qint64 key, QStringList tokens)
+{
+    QHash<qint64, QStringList>::const_iterator existing = m_tokens.constFind(key);
+    if (existing != m_tokens.constEnd() && existing.value() == tokens) {
+        return;
+    }
+
+    remove(key);
+
+    m_tokens.insert(key, tokens);
+    for (qint32 i = 0; i < tokens.size(); ++i) {
+        m_postings[tokens[i]].insert(key);
+    }
+}
+
+void PrefixIndex::remove(qint64 key)
+{
+    QHash<qint64, QStringList>::iterator i = m_tokens.find(key);
+    if (i == m_tokens.end()) {
+        return;
+    }
+
+    const QStringList &tokens = i.value();
+    for (qint32 j = 0; j < tokens.size(); ++j) {
+        QMap<QString, QSet<qint64> >::iterator posting = m_postings.find(tokens[j]);
+        if (posting == m_postings.end()) {
+            continue;
+        }
+
+        posting->remove(key);
+        if (posting->isEmpty()) {
+            m_postings.erase(posting);
+        }
+    }
+
+    m_tokens.erase(i);
+}
+
+void PrefixIndex::clear()
+{
+    m_tokens.clear();
+    m_postings.clear();
+}
+
+qint32 PrefixIndex::size() const
+{
+    return m_tokens.size();
+}
+
+QStringList PrefixIndex::tokens(qint64 key) const
+{
+    return m_tokens.value(key);
+}
+
+QSet<qint64> PrefixIndex::matches(QString prefix) const
+{
+    QSet<qint64> result;
+    for (QMap<QString, QSet<qint64> >::const_iterator i = m_postings.lowerBound(prefix); i != m_postings.constEnd() && i.key().startsWith(prefix); ++i) {
+        result.unite(i.value());
+    }
+
+    return result;
+}
+
+QHash<qint64, qint32> PrefixIndex::search(QStringList query) const
+{
+    QHash<qint64, qint32> result;
+    if (query.isEmpty()) {
+        return result;
+    }
+
+    //Longer prefixes match fewer tokens, start with them to keep the intersection small
+    QStringList ordered = query;
+    std::sort(ordered.begin(), ordered.end(), [](const QString &a, const QString &b) {
+        return a.size() > b.size();
+    });
+
+    QSet<qint64> keys = matches(ordered[0]);
+    for (qint32 i = 1; i < ordered.size() && !keys.isEmpty(); ++i) {
+        keys.intersect(matches(ordered[i]));
+    }
+
+    result.reserve(keys.size());
+    for (QSet<qint64>::const_iterator i = keys.constBegin(); i != keys.constEnd(); ++i) {
+        result.insert(*i, score(m_tokens.value(*i), query));
+    }
+
+    return result;
+}
+
+qint32 PrefixIndex::score(const QStringList &tokens, const QStringList &query)
+{
+    qint32 total = 0;
+    for (qint32 i = 0; i < query.size(); ++i) {
+        qint32 best = 0;
+        for (qint32 j = 0; j < tokens.size(); ++j) {
+            qint32 score = 0;
+            if (tokens[j] == query[i]) {
+                score = EXACT_SCORE;
+            } else if (tokens[j].startsWith(query[i])) {
+                score = PREFIX_SCORE;
+            } else {
+                continue;
+            }
+
+            if (j == 0) {
+                score += FIRST_TOKEN_BONUS;
+            }
+            best = qMax(best, score);
+        }
+
+        if (best == 0) {
+            return 0;
+        }
+        total += best;
+    }
+
+    return total;
+}
@@ -0,0 +1,37 @@
+#ifndef PREFIXINDEX_H
+#define PREFIXINDEX_H
+
+#include <QHash>
+#include <QMap>
+#include <QSet>
+#include <QStringList>
+
+//Small in-memory prefix index from normalized tokens (see SearchIndex::tokenize)
+//to integer keys. Tokens are kept sorted, so a prefix is a range of the map.
+class PrefixIndex
+{
+public:
+    PrefixIndex();
+
+    //Replaces the tokens of key, the order of tokens matters for score()
+    void insert(qint64 key, QStringList tokens);
+    void remove(qint64 key);
+    void clear();
+
+    qint32 size() const;
+    QStringList tokens(qint64 key) const;
+
+    QSet<qint64> matches(QString prefix) const;
+    //Keys matching every query token as a prefix, with their score
+    QHash<qint64, qint32> search(QStringList query) const;
+
+    //0 if some query token matches nothing. Whole tokens rank above prefixes,
+    //and a match of the first token (the start of a title) above the rest.
+    static qint32 score(const QStringList &tokens, const QStringList &query);
+
+private:
+    QHash<qint64, QStringList> m_tokens;
+    QMap<QString, QSet<qint64> > m_postings;
+};
+
+#endif // PREFIXINDEX_H
@@ -0,0 +1,188 @@
+#include "searchresultsmodel.h"
+
+#include "../searchindex.h"
+#include "../messageutil.h"
+#include "../timeformatter.h"
+#include "../tracer.h"
+
+#define PAGE_SIZE 30
+//Characters of context kept before the first match in a snippet
+#define SNIPPET_LEAD 40
+#define SNIPPET_LENGTH 200
+
+SearchResultsModel::SearchResultsModel(QObject *parent)
+    : DiffListModel(parent)
+    , m_query()
+    , m_results()
+    , m_rows()
+{
+    connect(SearchIndex::instance(), SIGNAL(changed()), this, SLOT(indexChanged()));
+    connect(TimeFormatter::instance(), SIGNAL(changed()), this, SLOT(timeFormatChanged()));
+}
+
+QHash<int, QByteArray> SearchResultsModel::roleNames() const
+{
+    static QHash<int, QByteArray> roles;
+
+    if (!roles.isEmpty())
+        return roles;
+
+    roles[PeerHandleRole] = "peerHandle";
+    roles[MessageIdRole] = "messageId";
+    roles[TitleRole] = "title";
+    roles[MessageTextRole] = "messageText";
+    roles[MessageTimeRole] = "messageTime";
+
+    return roles;
+}
+
+int SearchResultsModel::rowCount(const QModelIndex &parent) const
+{
+    Q_UNUSED(parent);
+    return m_rows.size();
+}
+
+QVariant SearchResultsModel::data(const QModelIndex &index, int role) const
+{
+    if (index.row() < 0 || index.row() >= m_rows.size())
+        return QVariant();
+
+    if (role == MessageTimeRole) {
+        return TimeFormatter::instance()->dialogTime(m_rows[index.row()]["date"].toInt());
+    }
+
+    return m_rows[index.row()][roleNames()[role]];
+}
+
+void SearchResultsModel::setQuery(QString query)
+{
+    if (m_query == query) {
+        return;
+    }
+
+    m_query = query;
+    emit queryChanged();
+
+    search(PAGE_SIZE);
+}
+
+QString SearchResultsModel::query() const
+{
+    return m_query;
+}
+
+qint32 SearchResultsModel::totalCount() const
+{
+    return m_results.size();
+}
+
+void SearchResultsModel::search(qint32 minRows)
+{
+    TRACE_SPAN("SearchResultsModel::search");
+
+    beginResetModel();
+    m_results = SearchIndex::instance()->search(m_query);
+    m_rows.clear();
+
+    qint32 count = qMin(minRows, m_results.size());
+    for (qint32 i = 0; i < count; ++i) {
+        m_rows.append(createRow(m_results[i]));
+    }
+    endResetModel();
+
+    emit totalCountChanged();
+}
+
+void SearchResultsModel::indexChanged()
+{
+    if (m_query.isEmpty()) {
+        return;
+    }
+
+    TRACE_SPAN("SearchResultsModel::indexChanged");
+
+    m_results = SearchIndex::instance()->search(m_query);
+
+    //Keep as many rows as were already scrolled through
+    qint32 count = qMin(qMax(m_rows.size(), PAGE_SIZE), m_results.size());
+    QList<TgObject> next;
+    next.reserve(count);
+    for (qint32 i = 0; i < count; ++i) {
+        next.append(createRow(m_results[i]));
+    }
+
+    updateRows(m_rows, next, "documentId");
+
+    emit totalCountChanged();
+}
+
+void SearchResultsModel::timeFormatChanged()
+{
+    if (m_rows.isEmpty()) {
+        return;
+    }
+
+    emit dataChanged(index(0), index(m_rows.size() - 1), QVector<int>() << MessageTimeRole);
+}
+
+bool SearchResultsModel::canFetchMoreDownwards() const
+{
+    return m_rows.size() < m_results.size();
+}
+
+void SearchResultsModel::fetchMoreDownwards()
+{
+    if (!canFetchMoreDownwards()) {
+        return;
+    }
+
+    qint32 count = qMin(PAGE_SIZE, m_results.size() - m_rows.size());
+    beginInsertRows(QModelIndex(), m_rows.size(), m_rows.size() + count - 1);
+    for (qint32 i = 0; i < count; ++i) {
+        m_rows.append(createRow(m_results[m_rows.size()]));
+    }
+    endInsertRows();
+}
+
+TgObject SearchResultsModel::createRow(qint32 documentId)
+{
+    TgObject document = SearchIndex::instance()->document(documentId);
+    qint64 handle = document["peer"].toLongLong();
+
+    TgObject row;
+    row["documentId"] = documentId;
+    row["peerHandle"] = handle;
+    row["messageId"] = document["messageId"];
+    row["date"] = document["date"];
+
+    TgObject peer = registeredPeer(handle);
+    if (TgClient::isUser(peer)) {
+        row["title"] = QString(peer["first_name"].toString() + " " + peer["last_name"].toString());
+    } else {
+        row["title"] = peer["title"].toString();
+    }
+
+    //Start the snippet shortly before the first query token found in the text
+    QString text = document["text"].toString().simplified();
+    QStringList tokens = SearchIndex::tokenize(m_query);
+    QString folded = text.toCaseFolded();
+    qint32 position = -1;
+    for (qint32 i = 0; i < tokens.size(); ++i) {
+        qint32 found = folded.indexOf(tokens[i]);
+        if (found != -1 && (position == -1 || found < position)) {
+            position = found;
+        }
+    }
+
+    qint32 start = position > SNIPPET_LEAD ? position - SNIPPET_LEAD : 0;
+    QString snippet = text.mid(start, SNIPPET_LENGTH);
+    if (start > 0) {
+        snippet.prepend(QChar(0x2026));
+    }
+    if (start + SNIPPET_LENGTH < text.size()) {
+        snippet.append(QChar(0x2026));
+    }
+    row["messageText"] = snippet;
+
+    return row;
+}
@@ -0,0 +1,58 @@
+#ifndef SEARCHRESULTSMODEL_H
+#define SEARCHRESULTSMODEL_H
+
+#include "tgclient.h"
+#include "difflistmodel.h"
+
+//Messages of the on-device SearchIndex matching query, newest first. The index
+//returns only document ids, rows are materialized a page at a time as the list
+//is scrolled. Index changes are diffed into the rows, the scroll position stays.
+class SearchResultsModel : public DiffListModel
+{
+    Q_OBJECT
+    Q_PROPERTY(QString query READ query WRITE setQuery NOTIFY queryChanged)
+    Q_PROPERTY(qint32 totalCount READ totalCount NOTIFY totalCountChanged)
+
+public:
+    explicit SearchResultsModel(QObject *parent = 0);
+
+    QHash<int, QByteArray> roleNames() const;
+
+    int rowCount(const QModelIndex& parent = QModelIndex()) const;
+    QVariant data(const QModelIndex& index, int role = Qt::DisplayRole) const;
+
+    void setQuery(QString query);
+    QString query() const;
+
+    qint32 totalCount() const;
+
+signals:
+    void queryChanged();
+    void totalCountChanged();
+
+public slots:
+    void indexChanged();
+    void timeFormatChanged();
+
+    bool canFetchMoreDownwards() const;
+    void fetchMoreDownwards();
+
+private:
+    QString m_query;
+    QList<qint32> m_results;
+    QList<TgObject> m_rows;
+
+    void search(qint32 minRows);
+    TgObject createRow(qint32 documentId);
+
+    enum SearchResultRoles {
+        PeerHandleRole = Qt::UserRole + 1,
+        MessageIdRole,
+        TitleRole,
+        MessageTextRole,
+        MessageTimeRole
+    };
+
+};
+
+#endif // SEARCHRESULTSMODEL_H
@@ -0,0 +1,69 @@
+#ifndef SPSCQUEUE_H
+#define SPSCQUEUE_H
+
+#include <QAtomicPointer>
+
+//Unbounded lock-free queue for exactly one producer thread and one consumer thread.
+//The producer only touches m_tail, the consumer only m_head; they meet through
+//the release/acquire on Node::next.
+template <typename T>
+class SpscQueue
+{
+public:
+    SpscQueue()
+        : m_head(new Node())
+        , m_tail(m_head)
+    {
+    }
+
+    ~SpscQueue()
+    {
+        while (m_head) {
+            Node* next = m_head->next.load();
+            delete m_head;
+            m_head = next;
+        }
+    }
+
+    //Producer side
+    void push(const T &value)
+    {
+        Node* node = new Node();
+        node->value = value;
+
+        m_tail->next.storeRelease(node);
+        m_tail = node;
+    }
+
+    //Consumer side
+    bool pop(T &value)
+    {
+        Node* next = m_head->next.loadAcquire();
+        if (!next) {
+            return false;
+        }
+
+        value = next->value;
+        next->value = T();
+
+        delete m_head;
+        m_head = next;
+
+        return true;
+    }
+
+private:
+    struct Node {
+        Node() : value(), next(0) {}
+
+        T value;
+        QAtomicPointer<Node> next;
+    };
+
+    Q_DISABLE_COPY(SpscQueue)
+
+    Node* m_head;
+    Node* m_tail;
+};
+
+#endif // SPSCQUEUE_H
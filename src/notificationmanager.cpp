@@ -0,0 +1,150 @@
+#include "notificationmanager.h"
+
+#define DEFAULT_COALESCE_INTERVAL 3000
+#define DEFAULT_MAX_PER_MINUTE 6
+#define RATE_WINDOW 60000
+
+NotificationManager::NotificationManager(QObject *parent)
+    : QObject(parent)
+    , _mutex(QMutex::Recursive)
+    , _flushTimer()
+    , _coalesceInterval(DEFAULT_COALESCE_INTERVAL)
+    , _maxPerMinute(DEFAULT_MAX_PER_MINUTE)
+    , _pending()
+    , _order()
+    , _mutedPeers()
+    , _published()
+{
+    _flushTimer.setSingleShot(true);
+    connect(&_flushTimer, SIGNAL(timeout()), this, SLOT(flush()));
+}
+
+void NotificationManager::setCoalesceInterval(qint32 interval)
+{
+    _coalesceInterval = qMax(interval, 0);
+}
+
+qint32 NotificationManager::coalesceInterval() const
+{
+    return _coalesceInterval;
+}
+
+void NotificationManager::setMaxPerMinute(qint32 count)
+{
+    _maxPerMinute = qMax(count, 1);
+}
+
+qint32 NotificationManager::maxPerMinute() const
+{
+    return _maxPerMinute;
+}
+
+void NotificationManager::push(qint64 peerHandle, QString peerName, QString senderName, QString text, bool silent)
+{
+    QMutexLocker lock(&_mutex);
+
+    //Cheapest checks first, nothing is formatted for a muted peer
+    if (silent || _mutedPeers.contains(peerHandle)) {
+        return;
+    }
+
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+
+    if (!_pending.contains(peerHandle)) {
+        Pending pending;
+        pending.peerHandle = peerHandle;
+        pending.count = 0;
+        pending.firstTime = now;
+        _pending.insert(peerHandle, pending);
+        _order.append(peerHandle);
+    }
+
+    Pending &pending = _pending[peerHandle];
+    pending.peerName = peerName;
+    pending.senderName = senderName;
+    pending.text = text;
+    ++pending.count;
+
+    schedule(now);
+}
+
+void NotificationManager::setPeerMuted(qint64 peerHandle, bool muted)
+{
+    QMutexLocker lock(&_mutex);
+
+    if (muted) {
+        _mutedPeers.insert(peerHandle);
+        clear(peerHandle);
+    } else {
+        _mutedPeers.remove(peerHandle);
+    }
+}
+
+void NotificationManager::clear(qint64 peerHandle)
+{
+    QMutexLocker lock(&_mutex);
+
+    _pending.remove(peerHandle);
+    _order.removeOne(peerHandle);
+}
+
+qint32 NotificationManager::availableSlots(qint64 now)
+{
+    while (!_published.isEmpty() && now - _published.first() >= RATE_WINDOW) {
+        _published.removeFirst();
+    }
+
+    return _maxPerMinute - _published.size();
+}
+
+void NotificationManager::schedule(qint64 now)
+{
+    if (_order.isEmpty()) {
+        _flushTimer.stop();
+        return;
+    }
+
+    //The oldest burst is due when its window closes, or later if the rate cap is reached
+    qint64 due = _pending[_order.first()].firstTime + _coalesceInterval;
+    if (availableSlots(now) <= 0) {
+        due = qMax(due, _published.first() + RATE_WINDOW);
+    }
+
+    qint32 delay = qMax<qint64>(due - now, 0);
+    if (!_flushTimer.isActive() || _flushTimer.remainingTime() > delay) {
+        _flushTimer.start(delay);
+    }
+}
+
+void NotificationManager::flush()
+{
+    QMutexLocker lock(&_mutex);
+
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+
+    while (!_order.isEmpty() && availableSlots(now) > 0) {
+        Pending pending = _pending[_order.first()];
+        if (now - pending.firstTime < _coalesceInterval) {
+            break;
+        }
+
+        _pending.remove(pending.peerHandle);
+        _order.removeFirst();
+        _published.append(now);
+
+        QString body = pending.text;
+        //Empty for private chats and channels, the summary names the peer already
+        if (!pending.senderName.isEmpty()) {
+            body = pending.senderName + ": " + body;
+        }
+
+        QString summary = pending.peerName;
+        if (pending.count > 1) {
+            summary += " (" + tr("%n new message(s)", "", pending.count) + ")";
+        }
+
+        emit notify(pending.peerHandle, summary, body, pending.count);
+    }
+
+    schedule(now);
+}
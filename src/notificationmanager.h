@@ -0,0 +1,64 @@
+#ifndef NOTIFICATIONMANAGER_H
+#define NOTIFICATIONMANAGER_H
+
+#include <QObject>
+
+#include <QMutex>
+#include <QHash>
+#include <QSet>
+#include <QTimer>
+#include <QDateTime>
+
+//Coalesces message notifications: a burst from one peer (by peerHandle()) inside coalesceInterval
+//turns into a single summarized notification, muted peers are dropped on arrival
+//and no more than maxPerMinute notifications are published overall.
+class NotificationManager : public QObject
+{
+    Q_OBJECT
+    Q_PROPERTY(qint32 coalesceInterval READ coalesceInterval WRITE setCoalesceInterval)
+    Q_PROPERTY(qint32 maxPerMinute READ maxPerMinute WRITE setMaxPerMinute)
+
+private:
+    struct Pending {
+        qint64 peerHandle;
+        QString peerName;
+        QString senderName;
+        QString text;
+        qint32 count;
+        qint64 firstTime;
+    };
+
+    QMutex _mutex;
+    QTimer _flushTimer;
+    qint32 _coalesceInterval;
+    qint32 _maxPerMinute;
+
+    QHash<qint64, Pending> _pending;
+    QList<qint64> _order;
+    QSet<qint64> _mutedPeers;
+    QList<qint64> _published;
+
+    qint32 availableSlots(qint64 now);
+    void schedule(qint64 now);
+
+public:
+    explicit NotificationManager(QObject *parent = 0);
+
+    void setCoalesceInterval(qint32 interval);
+    qint32 coalesceInterval() const;
+
+    void setMaxPerMinute(qint32 count);
+    qint32 maxPerMinute() const;
+
+signals:
+    void notify(qint64 peerHandle, QString summary, QString body, qint32 count);
+
+public slots:
+    void push(qint64 peerHandle, QString peerName, QString senderName, QString text, bool silent);
+    void setPeerMuted(qint64 peerHandle, bool muted);
+    void clear(qint64 peerHandle);
+    void flush();
+
+};
+
+#endif // NOTIFICATIONMANAGER_H
@@ -1,5 +1,7 @@
 import QtQuick 2.0
 import Sailfish.Silica 1.0
+import Nemo.Notifications 1.0
+import Nemo.Configuration 1.0
 
 import Kutegram 1.0
 import ru.neochapay.samoletik 1.0
@@ -8,15 +10,29 @@ ApplicationWindow {
     id: root
     property bool needAuth: true
 
+    //Created after the first frame, see startupTimer
+    property QtObject messagesModel: null
+    property var converstationPageComponent: null
+
     allowedOrientations: Orientation.Portrait
     initialPage: getInitPage()
 
     cover: Qt.resolvedUrl("cover/CoverPage.qml")
 
+    //System wide 12/24-hour clock setting
+    ConfigurationValue {
+        id: timeFormatSetting
+        key: "/sailfish/i18n/lc_timeformat24h"
+        defaultValue: timeFormatter.use24HourClock ? "24" : "12"
+        onValueChanged: timeFormatter.use24HourClock = (value !== "12")
+        Component.onCompleted: timeFormatter.use24HourClock = (value !== "12")
+    }
+
     TgClient {
         id: telegramClient
 
         onInitialized: {
+            startupTimeline.mark("client_initialized")
             if (hasUserId) {
                 return;
             }
@@ -38,19 +54,141 @@ ApplicationWindow {
         folders: foldersModel
         client: telegramClient
         avatarDownloader: globalAvatarDownloader
+        readState: readStateTracker
+        updates: updatesSync
+    }
+
+    UpdatesSync {
+        id: updatesSync
+        client: telegramClient
+
+        onResyncRequired: {
+            foldersModel.refresh()
+            dialogsModel.refresh()
+        }
+    }
+
+    //Waking up: catch up with what was missed while suspended
+    Connections {
+        target: Qt.application
+        onActiveChanged: {
+            if (Qt.application.active) {
+                updatesSync.sync()
+            } else {
+                diskCacheManager.trim()
+            }
+        }
+    }
+
+    ReadStateTracker {
+        id: readStateTracker
+        client: telegramClient
+    }
+
+    NotificationManager {
+        id: notificationManager
+        property var published: ({})
+
+        onNotify: {
+            var notification = published[peerHandle]
+            if (!notification) {
+                notification = notificationComponent.createObject(root)
+                published[peerHandle] = notification
+            }
+
+            notification.summary = summary
+            notification.previewSummary = summary
+            notification.body = body
+            notification.previewBody = body
+            notification.itemCount = count
+            notification.publish()
+        }
+    }
+
+    Component {
+        id: notificationComponent
+        Notification {
+            appName: "Samoletik"
+            category: "x-nemo.messaging.im"
+        }
+    }
+
+    Connections {
+        target: dialogsModel
+        onSendNotification: {
+            notificationManager.push(peerHandle, peerName, senderName, text, silent)
+        }
+        onNotifySettingsChanged: {
+            notificationManager.setPeerMuted(peerHandle, muted)
+        }
     }
 
     AvatarDownloader {
         id: globalAvatarDownloader
         client: telegramClient
+        //Matches the photo width in MessageListItem
+        photoDisplaySize: Math.round(Screen.width * 0.6)
+    }
+
+    DownloadManager {
+        id: globalDownloadManager
+        client: telegramClient
     }
 
-    MessagesModel{
-        id: messagesModel
+    //Budgets in bytes, least recently used avatars and photos go first
+    DiskCacheManager {
+        id: diskCacheManager
         client: telegramClient
         avatarDownloader: globalAvatarDownloader
     }
 
+    Component {
+        id: messagesModelComponent
+        MessagesModel {
+            client: telegramClient
+            avatarDownloader: globalAvatarDownloader
+            downloadManager: globalDownloadManager
+            readState: readStateTracker
+            updates: updatesSync
+        }
+    }
+
+    //Non-essential startup work, runs once the dialog list had a chance to paint
+    Timer {
+        id: startupTimer
+        interval: 100
+        onTriggered: {
+            globalAvatarDownloader.loadDatabase()
+            globalDownloadManager.loadDatabase()
+            diskCacheManager.trim()
+            ensureMessagesModel()
+            converstationPageComponent = Qt.createComponent(Qt.resolvedUrl("pages/ConverstationPage.qml"), Component.Asynchronous)
+            startupTimeline.mark("deferred_startup_done")
+        }
+    }
+
+    Component.onCompleted: startupTimer.start()
+
+    function ensureMessagesModel() {
+        if (!messagesModel) {
+            messagesModel = messagesModelComponent.createObject(root)
+        }
+        return messagesModel
+    }
+
+    function openConversation(title, peer) {
+        var properties = {
+            dialogTitle: title,
+            peer: peer
+        }
+
+        if (converstationPageComponent && converstationPageComponent.status === Component.Ready) {
+            pageStack.push(converstationPageComponent, properties)
+        } else {
+            pageStack.push(Qt.resolvedUrl("pages/ConverstationPage.qml"), properties)
+        }
+    }
+
     function getInitPage() {
         if (telegramClient.hasSession()) {
             return Qt.resolvedUrl("pages/ConverstationListPage.qml")
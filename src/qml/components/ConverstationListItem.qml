@@ -52,6 +52,12 @@ Item {
 
         asynchronous: true
         source: avatar
+
+        onStatusChanged: {
+            if (status == Image.Ready) {
+                startupTimeline.mark("first_avatar_paint")
+            }
+        }
     }
 
     Column {
@@ -107,20 +113,37 @@ Item {
                 font.pixelSize: Theme.fontSizeSmall
                 anchors.top: parent.top
                 anchors.left: messageSenderLabel.right
-                anchors.right: parent.right
+                anchors.right: unreadBadge.visible ? unreadBadge.left : parent.right
+                anchors.rightMargin: unreadBadge.visible ? Theme.paddingSmall : 0
 
                 onLinkActivated: {
                     openDialog();
                 }
             }
+
+            Rectangle {
+                id: unreadBadge
+                visible: unreadCount > 0
+                anchors.verticalCenter: messageTextLabel.verticalCenter
+                anchors.right: parent.right
+
+                width: Math.max(height, unreadText.width + Theme.paddingSmall * 2)
+                height: unreadText.height
+                radius: height / 2
+                color: Theme.highlightBackgroundColor
+
+                Text {
+                    id: unreadText
+                    anchors.centerIn: parent
+                    text: unreadCount
+                    color: Theme.primaryColor
+                    font.pixelSize: Theme.fontSizeExtraSmall
+                }
+            }
         }
     }
 
     function openDialog() {
-        pageStack.push(Qt.resolvedUrl("../pages/ConverstationPage.qml"),
-                       {
-                            dialogTitle: title,
-                            peer: peerBytes
-                       })
+        root.openConversation(title, peerHandle)
     }
 }
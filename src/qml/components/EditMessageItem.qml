@@ -1,16 +1,55 @@
 import QtQuick 2.0
 import Sailfish.Silica 1.0
+import Sailfish.Pickers 1.0
 
 Item {
+    id: editMessageItem
     height: messageText.height
 
+    property int uploadProgress: -1
+    property QtObject messagesModel
+
+    Connections {
+        target: messagesModel
+        onUploadingProgress: {
+            editMessageItem.uploadProgress = progress
+        }
+    }
+
     Row{
         anchors.fill: parent
         spacing: Theme.paddingSmall
 
+        IconButton {
+            id: attachButtonIcon
+            icon.source: "image://theme/icon-m-attach?" + (pressed
+                                                           ? Theme.highlightColor
+                                                           : Theme.primaryColor)
+            visible: editMessageItem.uploadProgress == -1
+            onClicked: {
+                pageStack.push(contentPickerPage)
+            }
+        }
+
+        IconButton {
+            id: cancelUploadIcon
+            icon.source: "image://theme/icon-m-clear?" + (pressed
+                                                          ? Theme.highlightColor
+                                                          : Theme.primaryColor)
+            visible: editMessageItem.uploadProgress != -1
+            onClicked: {
+                messagesModel.cancelUpload()
+            }
+
+            ProgressCircle {
+                anchors.fill: parent
+                value: Math.max(editMessageItem.uploadProgress, 0) / 100
+            }
+        }
+
         TextField{
             id: messageText
-            width: parent.width - sendButtonIcon.width - Theme.paddingSmall*3
+            width: parent.width - sendButtonIcon.width - attachButtonIcon.width - Theme.paddingSmall*4
         }
 
         IconButton {
@@ -18,12 +57,20 @@ Item {
             icon.source: "image://theme/icon-m-send?" + (pressed
                                                          ? Theme.highlightColor
                                                          : Theme.primaryColor)
-            enabled: messageText.text.length > 0
+            enabled: messageText.text.length > 0 || editMessageItem.uploadProgress == 100
             onClicked: {
                 messagesModel.sendMessage(messageText.text)
                 messageText.text = "";
             }
         }
     }
-}
 
+    Component {
+        id: contentPickerPage
+        ContentPickerPage {
+            onSelectedContentPropertiesChanged: {
+                messagesModel.uploadFile(selectedContentProperties.url)
+            }
+        }
+    }
+}
@@ -2,17 +2,47 @@ import QtQuick 2.0
 import Sailfish.Silica 1.0
 
 Item {
+    id: messageListItem
+    signal linkActivated(string link)
+    signal photoClicked()
+
     width: parent.width
-    height: messageTextItem.height + Theme.paddingMedium
+    height: messageColumn.height + Theme.paddingMedium
 
-    Text {
-        id: messageTextItem
+    Column {
+        id: messageColumn
         anchors.left: parent.left
         anchors.right: parent.right
+        spacing: Theme.paddingSmall
+
+        //Thumbnail at the display size, the full resolution is opened on tap
+        Image {
+            id: photoItem
+            visible: hasPhoto
+            width: Math.min(parent.width, Screen.width * 0.6)
+            height: visible ? width : 0
+            fillMode: Image.PreserveAspectFit
+            horizontalAlignment: Image.AlignLeft
+            asynchronous: true
+            source: hasPhoto ? photoFile : ""
+
+            MouseArea {
+                anchors.fill: parent
+                onClicked: messageListItem.photoClicked()
+            }
+        }
+
+        Text {
+            id: messageTextItem
+            anchors.left: parent.left
+            anchors.right: parent.right
+
+            wrapMode: Text.Wrap
+            text: messageText.length != 0 ? messageText : (hasPhoto ? "" : "Unsupported")
+            visible: text.length != 0
+            color: messageText.length != 0 ? Theme.primaryColor : Theme.highlightColor
 
-        wrapMode: Text.Wrap
-        text: messageText.length != 0 ? messageText : "Unsupported"
-        //visible: messageText.length != 0
-        color: messageText.length != 0 ? Theme.primaryColor : Theme.highlightColor
+            onLinkActivated: messageListItem.linkActivated(link)
+        }
     }
 }
@@ -1,5 +1,6 @@
 import QtQuick 2.0
 import Sailfish.Silica 1.0
+import ru.neochapay.samoletik 1.0
 
 import "../components"
 
@@ -9,41 +10,76 @@ Page {
 
     property string phoneNumber
     property string phoneCache
+    property bool searching: false
 
     Component.onCompleted: {
         telegramClient.start();
     }
 
-    Connections{
-        target: telegramClient
-        onAuthorized: {
-            foldersModel.refresh()
-            dialogsModel.refresh()
-        }
+    //The archive is only loaded once it is opened
+    DialogsProxyModel {
+        id: visibleDialogs
+        dialogs: dialogsModel
     }
 
     SilicaFlickable {
         anchors.fill: parent
         VerticalScrollDecorator {}
 
+        PullDownMenu {
+            MenuItem {
+                text: searching ? qsTr("Hide search") : qsTr("Search chats")
+                onClicked: {
+                    searching = !searching
+                    if (!searching) {
+                        dialogSearchField.text = ""
+                    }
+                }
+            }
+            MenuItem {
+                text: qsTr("Search messages")
+                onClicked: pageStack.push(Qt.resolvedUrl("SearchPage.qml"))
+            }
+            MenuItem {
+                text: visibleDialogs.folderId == 1 ? qsTr("Chats") : qsTr("Archive")
+                onClicked: visibleDialogs.folderId = visibleDialogs.folderId == 1 ? 0 : 1
+            }
+        }
+
         PageHeader {
             id: header
-            title: qsTr("Converstations")
+            title: visibleDialogs.folderId == 1 ? qsTr("Archive") : qsTr("Converstations")
+        }
+
+        SearchField {
+            id: dialogSearchField
+            width: parent.width
+            anchors.top: header.bottom
+            visible: searching
+            height: visible ? implicitHeight : 0
+            placeholderText: qsTr("Search chats")
+            inputMethodHints: Qt.ImhNoPredictiveText
+            onVisibleChanged: {
+                if (visible) {
+                    forceActiveFocus()
+                }
+            }
+            onTextChanged: visibleDialogs.query = text
         }
 
         ListView {
             id: folderSlide
             width: parent.width - Theme.paddingMedium * 2
-            height: parent.height - header.height
+            height: parent.height - header.height - dialogSearchField.height
             anchors{
-                top: header.bottom
+                top: dialogSearchField.bottom
                 topMargin: Theme.paddingMedium
                 left: parent.left
                 leftMargin: Theme.paddingMedium
             }
 
             clip: true
-            model: dialogsModel
+            model: visibleDialogs
             boundsBehavior: Flickable.StopAtBounds
             snapMode: ListView.SnapOneItem
             highlightRangeMode: ListView.StrictlyEnforceRange
@@ -51,5 +87,53 @@ Page {
             highlightMoveDuration: 200
             delegate:  ConverstationListItem{}
         }
+
+        //Skeleton rows until the first page arrives, an account may have no dialogs at all
+        Column {
+            id: dialogsSkeleton
+            width: folderSlide.width
+            anchors{
+                top: header.bottom
+                topMargin: Theme.paddingMedium
+                left: parent.left
+                leftMargin: Theme.paddingMedium
+            }
+            spacing: Theme.paddingMedium
+            visible: !dialogsModel.loaded && folderSlide.count == 0 && visibleDialogs.folderId == 0 && visibleDialogs.query.length == 0
+
+            Repeater {
+                model: Math.ceil(folderSlide.height / (Theme.itemSizeMedium + Theme.paddingMedium))
+                delegate: Row {
+                    spacing: Theme.paddingMedium
+                    height: Theme.itemSizeMedium
+
+                    Rectangle {
+                        width: Theme.itemSizeMedium
+                        height: width
+                        radius: width / 2
+                        color: Theme.rgba(Theme.highlightBackgroundColor, 0.1)
+                    }
+
+                    Column {
+                        anchors.verticalCenter: parent.verticalCenter
+                        spacing: Theme.paddingSmall
+
+                        Rectangle {
+                            width: dialogsSkeleton.width * 0.4
+                            height: Theme.fontSizeMedium
+                            radius: Theme.paddingSmall
+                            color: Theme.rgba(Theme.highlightBackgroundColor, 0.1)
+                        }
+
+                        Rectangle {
+                            width: dialogsSkeleton.width * 0.6
+                            height: Theme.fontSizeSmall
+                            radius: Theme.paddingSmall
+                            color: Theme.rgba(Theme.highlightBackgroundColor, 0.05)
+                        }
+                    }
+                }
+            }
+        }
     }
 }
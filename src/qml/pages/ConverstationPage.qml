@@ -10,6 +10,10 @@ Page {
 
     property string dialogTitle: qsTr("Loading...")
     property var peer
+    property QtObject messagesModel: root.ensureMessagesModel()
+    //Message whose full resolution photo is awaited by photoPage
+    property int openedPhotoId: 0
+    property var photoPage
 
     SilicaFlickable {
         anchors.fill: parent
@@ -35,17 +39,37 @@ Page {
             cacheBuffer: Math.max(parent.height / 6, 0)
             snapMode: ListView.SnapToItem
 
+            onHeightChanged: {
+                messagesModel.viewportRows = Math.ceil(height / Theme.itemSizeSmall)
+            }
+            onContentYChanged: {
+                var visibleIndex = indexAt(contentX, contentY + height / 2)
+                if (visibleIndex != -1) {
+                    messagesModel.viewportIndex = visibleIndex
+                }
+            }
+            onVerticalVelocityChanged: {
+                messagesModel.scrollVelocity = Math.abs(verticalVelocity) / Theme.itemSizeSmall
+            }
+
             onMovementEnded: {
                 if (atYBeginning && messagesModel.canFetchMoreUpwards()) {
                     messagesModel.fetchMoreUpwards();
                 }
                 if (atYEnd && messagesModel.canFetchMoreDownwards()) {
-                    messagesModel.canFetchMoreDownwards();
+                    messagesModel.fetchMoreDownwards();
                 }
             }
             VerticalScrollDecorator {}
             model: messagesModel
-            delegate: MessageListItem {}
+            delegate: MessageListItem {
+                onLinkActivated: messagesModel.linkActivated(link, index)
+                onPhotoClicked: {
+                    converstationPage.openedPhotoId = messageId
+                    converstationPage.photoPage = pageStack.push(Qt.resolvedUrl("PhotoPage.qml"))
+                    messagesModel.openPhoto(index)
+                }
+            }
             onCountChanged: scrollToBottom()
             Component.onCompleted: scrollToBottom()
 
@@ -57,11 +81,20 @@ Page {
                 onScrollTo: {
                     messageList.currentIndex = index
                 }
+                onSearchRequested: {
+                    pageStack.push(Qt.resolvedUrl("SearchPage.qml"), { query: query })
+                }
+                onPhotoOpened: {
+                    if (messageId == converstationPage.openedPhotoId && converstationPage.photoPage) {
+                        converstationPage.photoPage.source = filePath
+                    }
+                }
             }
         }
 
         EditMessageItem{
             id: editMessageItem
+            messagesModel: converstationPage.messagesModel
             width: parent.width - Theme.paddingMedium * 2
             anchors{
                 bottom: parent.bottom
@@ -72,7 +105,8 @@ Page {
         }
     }
 
+    //The messagesModel binding may not be evaluated yet when peer is set on push
     onPeerChanged: {
-        messagesModel.peer = converstationPage.peer
+        root.ensureMessagesModel().peer = converstationPage.peer
     }
 }
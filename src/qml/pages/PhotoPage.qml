@@ -0,0 +1,29 @@
+import QtQuick 2.0
+import Sailfish.Silica 1.0
+
+Page {
+    id: photoPage
+    allowedOrientations:  Orientation.All
+
+    property string source
+
+    SilicaFlickable {
+        id: photoFlickable
+        anchors.fill: parent
+        contentWidth: width
+        contentHeight: height
+
+        Image {
+            anchors.fill: parent
+            fillMode: Image.PreserveAspectFit
+            asynchronous: true
+            source: photoPage.source
+        }
+
+        BusyIndicator {
+            anchors.centerIn: parent
+            size: BusySize.Large
+            running: photoPage.source.length == 0
+        }
+    }
+}
@@ -0,0 +1,98 @@
+import QtQuick 2.0
+import Sailfish.Silica 1.0
+
+import ru.neochapay.samoletik 1.0
+
+Page {
+    id: searchPage
+    allowedOrientations:  Orientation.All
+
+    property string query
+
+    //Searches messages already seen on this device, no server round trip
+    SearchResultsModel {
+        id: searchResults
+        query: searchPage.query
+    }
+
+    SilicaListView {
+        id: resultsList
+        anchors.fill: parent
+        model: searchResults
+        currentIndex: -1
+
+        header: SearchField {
+            width: resultsList.width
+            placeholderText: qsTr("Search messages")
+            text: searchPage.query
+            inputMethodHints: Qt.ImhNoPredictiveText
+            onTextChanged: searchPage.query = text
+            Component.onCompleted: {
+                if (searchPage.query.length == 0) {
+                    forceActiveFocus()
+                }
+            }
+        }
+
+        delegate: ListItem {
+            contentHeight: Theme.itemSizeMedium
+
+            Label {
+                id: titleLabel
+                text: title
+                truncationMode: TruncationMode.Fade
+                anchors{
+                    top: parent.top
+                    topMargin: Theme.paddingSmall
+                    left: parent.left
+                    leftMargin: Theme.horizontalPageMargin
+                    right: timeLabel.left
+                    rightMargin: Theme.paddingSmall
+                }
+            }
+
+            Label {
+                id: timeLabel
+                text: messageTime
+                color: Theme.secondaryColor
+                font.pixelSize: Theme.fontSizeExtraSmall
+                anchors{
+                    verticalCenter: titleLabel.verticalCenter
+                    right: parent.right
+                    rightMargin: Theme.horizontalPageMargin
+                }
+            }
+
+            Label {
+                text: messageText
+                color: Theme.secondaryColor
+                font.pixelSize: Theme.fontSizeSmall
+                textFormat: Text.PlainText
+                truncationMode: TruncationMode.Fade
+                anchors{
+                    top: titleLabel.bottom
+                    left: parent.left
+                    leftMargin: Theme.horizontalPageMargin
+                    right: parent.right
+                    rightMargin: Theme.horizontalPageMargin
+                }
+            }
+
+            onClicked: root.openConversation(title, peerHandle)
+        }
+
+        onMovementEnded: {
+            if (atYEnd && searchResults.canFetchMoreDownwards()) {
+                searchResults.fetchMoreDownwards();
+            }
+        }
+
+        ViewPlaceholder {
+            enabled: resultsList.count == 0 && searchPage.query.length > 0
+            text: qsTr("No messages found")
+            hintText: qsTr("Only messages loaded on this device are searched")
+        }
+
+        VerticalScrollDecorator {}
+    }
+}
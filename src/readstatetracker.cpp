@@ -0,0 +1,129 @@
+#include "readstatetracker.h"
+
+#include "tlschema.h"
+#include "messageutil.h"
+
+#define DEFAULT_DEBOUNCE_INTERVAL 1000
+
+ReadStateTracker::ReadStateTracker(QObject *parent)
+    : QObject(parent)
+    , m_client(nullptr)
+    , m_userId(0)
+    , m_timer()
+    , m_readMaxIds()
+    , m_pending()
+{
+    m_timer.setSingleShot(true);
+    m_timer.setInterval(DEFAULT_DEBOUNCE_INTERVAL);
+    connect(&m_timer, SIGNAL(timeout()), this, SLOT(flush()));
+}
+
+void ReadStateTracker::setClient(QObject *client)
+{
+    TgClient* tclient = dynamic_cast<TgClient*>(client);
+    if (!tclient) {
+        return;
+    }
+
+    if (m_client) {
+        m_client->disconnect(this);
+    }
+
+    m_client = tclient;
+    m_userId = 0;
+    m_readMaxIds.clear();
+    m_pending.clear();
+
+    connect(m_client, SIGNAL(authorized(TgLongVariant)), this, SLOT(authorized(TgLongVariant)));
+}
+
+QObject* ReadStateTracker::client() const
+{
+    return m_client;
+}
+
+void ReadStateTracker::setDebounceInterval(qint32 interval)
+{
+    m_timer.setInterval(qMax(interval, 0));
+}
+
+qint32 ReadStateTracker::debounceInterval() const
+{
+    return m_timer.interval();
+}
+
+qint32 ReadStateTracker::readMaxId(qint64 peer) const
+{
+    return m_readMaxIds.value(peer);
+}
+
+void ReadStateTracker::authorized(TgLongVariant userId)
+{
+    if (m_userId != userId) {
+        m_readMaxIds.clear();
+        m_pending.clear();
+        m_userId = userId;
+    }
+}
+
+void ReadStateTracker::markRead(TgObject peer, qint32 maxId, qint32 readCount)
+{
+    qint64 handle = peerHandle(peer);
+    if (handle == 0) {
+        return;
+    }
+
+    if (!m_readMaxIds.contains(handle)) {
+        m_readMaxIds.insert(handle, peer["read_inbox_max_id"].toInt());
+    }
+
+    //Monotonic: anything at or below what is already read or queued is ignored
+    QHash<qint64, Pending>::iterator pending = m_pending.find(handle);
+    qint32 knownMaxId = pending == m_pending.end() ? m_readMaxIds.value(handle) : pending->maxId;
+    if (maxId <= knownMaxId) {
+        return;
+    }
+
+    if (pending == m_pending.end()) {
+        Pending entry;
+        entry.inputPeer = TgClient::toInputPeer(peer);
+        entry.maxId = maxId;
+        entry.readCount = readCount;
+        m_pending.insert(handle, entry);
+    } else {
+        pending->maxId = maxId;
+        pending->readCount += readCount;
+    }
+
+    if (!m_timer.isActive()) {
+        m_timer.start();
+    }
+}
+
+void ReadStateTracker::flush()
+{
+    if (!m_client || !m_client->isAuthorized()) {
+        //Keep it until the next report, it is retried with a higher max_id anyway
+        return;
+    }
+
+    for (QHash<qint64, Pending>::const_iterator i = m_pending.constBegin(); i != m_pending.constEnd(); ++i) {
+        TgObject inputPeer = i->inputPeer;
+
+        if (TgClient::isChannel(inputPeer)) {
+            TgObject inputChannel;
+            ID_PROPERTY(inputChannel) = TLType::InputChannel;
+            inputChannel["channel_id"] = inputPeer["channel_id"];
+            inputChannel["access_hash"] = inputPeer["access_hash"];
+
+            m_client->channelsReadHistory(inputChannel, i->maxId);
+        } else {
+            m_client->messagesReadHistory(inputPeer, i->maxId);
+        }
+
+        m_readMaxIds.insert(i.key(), i->maxId);
+        emit readStateChanged(i.key(), i->maxId, i->readCount);
+    }
+
+    m_pending.clear();
+}
@@ -0,0 +1,57 @@
+#ifndef READSTATETRACKER_H
+#define READSTATETRACKER_H
+
+#include <QObject>
+#include <QHash>
+#include <QTimer>
+#include "tgclient.h"
+
+//Collects read positions reported by the messages viewport and acknowledges them
+//with one readHistory/readChannelHistory per peer after a debounce. max_id only
+//ever moves forward; readStateChanged() lets the dialog list update its
+//counters locally.
+class ReadStateTracker : public QObject
+{
+    Q_OBJECT
+    Q_PROPERTY(QObject* client READ client WRITE setClient)
+    Q_PROPERTY(qint32 debounceInterval READ debounceInterval WRITE setDebounceInterval)
+
+public:
+    explicit ReadStateTracker(QObject *parent = 0);
+
+    void setClient(QObject *client);
+    QObject* client() const;
+
+    void setDebounceInterval(qint32 interval);
+    qint32 debounceInterval() const;
+
+    //Highest acknowledged (or server known) inbox max_id of a peer
+    qint32 readMaxId(qint64 peer) const;
+
+signals:
+    void readStateChanged(qint64 peer, qint32 maxId, qint32 readCount);
+
+public slots:
+    void authorized(TgLongVariant userId);
+
+    //peer is the dialog peer with its read_inbox_max_id, readCount the number of
+    //incoming messages this read covers
+    void markRead(TgObject peer, qint32 maxId, qint32 readCount);
+    void flush();
+
+private:
+    struct Pending {
+        TgObject inputPeer;
+        qint32 maxId;
+        qint32 readCount;
+    };
+
+    TgClient* m_client;
+    TgLongVariant m_userId;
+    QTimer m_timer;
+
+    QHash<qint64, qint32> m_readMaxIds;
+    QHash<qint64, Pending> m_pending;
+};
+
+#endif // READSTATETRACKER_H
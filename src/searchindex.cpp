@@ -0,0 +1,451 @@
+#include "searchindex.h"
+
+#include <QFile>
+#include <QDataStream>
+#include <QThreadPool>
+#include <QDebug>
+#include <algorithm>
+#include <functional>
+#include "tlschema.h"
+#include "messageutil.h"
+#include "tracer.h"
+#include "searchindexwriter.h"
+
+#define DEFAULT_MAX_DOCUMENTS 50000
+#define MAX_TOKEN_LENGTH 32
+#define SAVE_DELAY 10000
+#define CHANGED_DELAY 200
+
+SearchIndex* SearchIndex::instance()
+{
+    static SearchIndex* index = new SearchIndex();
+    return index;
+}
+
+SearchIndex::SearchIndex(QObject *parent)
+    : QObject(parent)
+    , MemoryReporter("SearchIndex")
+    , m_filePath()
+    , m_userId(0)
+    , m_maxDocuments(DEFAULT_MAX_DOCUMENTS)
+    , m_lastId(0)
+    , m_saveGeneration(0)
+    , m_documents()
+    , m_ids()
+    , m_postings()
+    , m_byDate()
+    , m_saveTimer()
+    , m_changedTimer()
+{
+    m_saveTimer.setSingleShot(true);
+    m_saveTimer.setInterval(SAVE_DELAY);
+    connect(&m_saveTimer, SIGNAL(timeout()), this, SLOT(save()));
+
+    //Bursts of history pages and updates result in one changed()
+    m_changedTimer.setSingleShot(true);
+    m_changedTimer.setInterval(CHANGED_DELAY);
+    connect(&m_changedTimer, SIGNAL(timeout()), this, SIGNAL(changed()));
+}
+
+QString SearchIndex::normalize(QString text)
+{
+    QString decomposed = text.normalized(QString::NormalizationForm_KD);
+
+    QString result;
+    result.reserve(decomposed.size());
+    for (qint32 i = 0; i < decomposed.size(); ++i) {
+        if (decomposed[i].category() != QChar::Mark_NonSpacing) {
+            result.append(decomposed[i]);
+        }
+    }
+
+    return result.toCaseFolded();
+}
+
+QStringList SearchIndex::tokenize(QString text)
+{
+    QString normalized = normalize(text);
+
+    //Hashtags and cashtags split on their sigil, "#tag" is found by "tag" and vice versa
+    QStringList tokens;
+    qint32 start = -1;
+    for (qint32 i = 0; i <= normalized.size(); ++i) {
+        if (i < normalized.size() && normalized[i].isLetterOrNumber()) {
+            if (start == -1) {
+                start = i;
+            }
+            continue;
+        }
+
+        if (start != -1) {
+            tokens << normalized.mid(start, qMin(i - start, MAX_TOKEN_LENGTH));
+            start = -1;
+        }
+    }
+
+    tokens.removeDuplicates();
+    return tokens;
+}
+
+TgObject SearchIndex::prepare(qint64 peer, TgObject message)
+{
+    TgObject document;
+
+    QString text = message["message"].toString();
+    if (peer == 0 || text.trimmed().isEmpty()) {
+        return document;
+    }
+
+    document["peer"] = peer;
+    document["messageId"] = message["id"].toInt();
+    document["date"] = message["date"].toInt();
+    document["text"] = text;
+    document["tokens"] = tokenize(text);
+
+    return document;
+}
+
+void SearchIndex::open(QString filePath, qint64 userId)
+{
+    if (m_filePath == filePath && m_userId == userId) {
+        return;
+    }
+
+    if (m_saveTimer.isActive()) {
+        save();
+    }
+
+    clear();
+    m_filePath = filePath;
+    m_userId = userId;
+    load();
+}
+
+void SearchIndex::clear()
+{
+    m_documents.clear();
+    m_ids.clear();
+    m_postings.clear();
+    m_byDate.clear();
+    touch();
+}
+
+void SearchIndex::setMaxDocuments(qint32 count)
+{
+    m_maxDocuments = qMax(count, 1);
+    evict();
+}
+
+qint32 SearchIndex::maxDocuments() const
+{
+    return m_maxDocuments;
+}
+
+void SearchIndex::insert(const Document &document)
+{
+    QPair<qint64, qint32> key(document.peer, document.messageId);
+
+    //Edits replace the whole document
+    qint32 documentId = m_ids.value(key);
+    if (documentId) {
+        remove(documentId);
+    }
+
+    documentId = ++m_lastId;
+    m_documents.insert(documentId, document);
+    m_ids.insert(key, documentId);
+    m_byDate.insert(((qint64) document.date << 32) | documentId, documentId);
+
+    for (qint32 i = 0; i < document.tokens.size(); ++i) {
+        m_postings[document.tokens[i]].insert(documentId);
+    }
+}
+
+void SearchIndex::remove(qint32 documentId)
+{
+    QHash<qint32, Document>::iterator i = m_documents.find(documentId);
+    if (i == m_documents.end()) {
+        return;
+    }
+
+    const Document &document = i.value();
+    for (qint32 j = 0; j < document.tokens.size(); ++j) {
+        QMap<QString, QSet<qint32> >::iterator posting = m_postings.find(document.tokens[j]);
+        if (posting == m_postings.end()) {
+            continue;
+        }
+
+        posting->remove(documentId);
+        if (posting->isEmpty()) {
+            m_postings.erase(posting);
+        }
+    }
+
+    m_ids.remove(qMakePair(document.peer, document.messageId));
+    m_byDate.remove(((qint64) document.date << 32) | documentId);
+    m_documents.erase(i);
+}
+
+void SearchIndex::evict()
+{
+    while (m_documents.size() > m_maxDocuments && !m_byDate.isEmpty()) {
+        remove(m_byDate.begin().value());
+    }
+}
+
+void SearchIndex::touch()
+{
+    if (!m_saveTimer.isActive()) {
+        m_saveTimer.start();
+    }
+    if (!m_changedTimer.isActive()) {
+        m_changedTimer.start();
+    }
+}
+
+void SearchIndex::addDocument(TgObject document)
+{
+    addDocuments(TgList() << document);
+}
+
+void SearchIndex::addDocuments(TgList documents)
+{
+    if (documents.isEmpty()) {
+        return;
+    }
+
+    TRACE_SPAN_ARG("SearchIndex::addDocuments", "documents", documents.size());
+    for (qint32 i = 0; i < documents.size(); ++i) {
+        TgObject document = documents[i].toMap();
+        if (document.isEmpty()) {
+            continue;
+        }
+
+        Document entry;
+        entry.peer = document["peer"].toLongLong();
+        entry.messageId = document["messageId"].toInt();
+        entry.date = document["date"].toInt();
+        entry.text = document["text"].toString();
+        entry.tokens = document["tokens"].toStringList();
+
+        insert(entry);
+    }
+
+    evict();
+    touch();
+}
+
+void SearchIndex::removeMessage(qint64 peer, qint32 messageId)
+{
+    qint32 documentId = m_ids.value(qMakePair(peer, messageId));
+    if (!documentId) {
+        return;
+    }
+
+    remove(documentId);
+    touch();
+}
+
+void SearchIndex::removeCommonMessages(QSet<qint32> messageIds)
+{
+    if (messageIds.isEmpty()) {
+        return;
+    }
+
+    QList<qint32> ids;
+    for (QHash<qint32, Document>::const_iterator i = m_documents.constBegin(); i != m_documents.constEnd(); ++i) {
+        if (!isChannelHandle(i.value().peer) && messageIds.contains(i.value().messageId)) {
+            ids << i.key();
+        }
+    }
+
+    for (qint32 i = 0; i < ids.size(); ++i) {
+        remove(ids[i]);
+    }
+
+    if (!ids.isEmpty()) {
+        touch();
+    }
+}
+
+QSet<qint32> SearchIndex::matches(QString prefix) const
+{
+    QSet<qint32> result;
+    for (QMap<QString, QSet<qint32> >::const_iterator i = m_postings.lowerBound(prefix); i != m_postings.constEnd() && i.key().startsWith(prefix); ++i) {
+        result.unite(i.value());
+    }
+
+    return result;
+}
+
+QList<qint32> SearchIndex::search(QString query) const
+{
+    TRACE_SPAN("SearchIndex::search");
+
+    QStringList tokens = tokenize(query);
+    if (tokens.isEmpty()) {
+        return QList<qint32>();
+    }
+
+    //Longer prefixes match fewer tokens, start with them to keep the intersection small
+    std::sort(tokens.begin(), tokens.end(), [](const QString &a, const QString &b) {
+        return a.size() > b.size();
+    });
+
+    QSet<qint32> result = matches(tokens[0]);
+    for (qint32 i = 1; i < tokens.size() && !result.isEmpty(); ++i) {
+        result.intersect(matches(tokens[i]));
+    }
+
+    QList<qint64> ordered;
+    ordered.reserve(result.size());
+    for (QSet<qint32>::const_iterator i = result.constBegin(); i != result.constEnd(); ++i) {
+        ordered << (((qint64) m_documents.value(*i).date << 32) | *i);
+    }
+    std::sort(ordered.begin(), ordered.end(), std::greater<qint64>());
+
+    QList<qint32> ids;
+    ids.reserve(ordered.size());
+    for (qint32 i = 0; i < ordered.size(); ++i) {
+        ids << (qint32) (ordered[i] & 0xFFFFFFFF);
+    }
+
+    return ids;
+}
+
+TgObject SearchIndex::document(qint32 documentId) const
+{
+    TgObject document;
+
+    QHash<qint32, Document>::const_iterator i = m_documents.find(documentId);
+    if (i == m_documents.constEnd()) {
+        return document;
+    }
+
+    document["peer"] = i.value().peer;
+    document["messageId"] = i.value().messageId;
+    document["date"] = i.value().date;
+    document["text"] = i.value().text;
+
+    return document;
+}
+
+void SearchIndex::gotUpdate(TgObject update)
+{
+    switch (ID(update)) {
+    case TLType::UpdateNewMessage:
+    case TLType::UpdateNewChannelMessage:
+    case TLType::UpdateEditMessage:
+    case TLType::UpdateEditChannelMessage:
+    {
+        TgObject message = update["message"].toMap();
+        qint64 peer = peerHandle(message["peer_id"].toMap());
+
+        //An edit can remove the text, leaving only media
+        TgObject document = prepare(peer, message);
+        if (document.isEmpty()) {
+            removeMessage(peer, message["id"].toInt());
+        } else {
+            addDocument(document);
+        }
+        break;
+    }
+    case TLType::UpdateDeleteChannelMessages:
+    {
+        qint64 peer = channelHandle(update["channel_id"].toLongLong());
+        TgList ids = update["messages"].toList();
+        for (qint32 i = 0; i < ids.size(); ++i) {
+            removeMessage(peer, ids[i].toInt());
+        }
+        break;
+    }
+    case TLType::UpdateDeleteMessages:
+    {
+        TgList ids = update["messages"].toList();
+        QSet<qint32> messageIds;
+        for (qint32 i = 0; i < ids.size(); ++i) {
+            messageIds.insert(ids[i].toInt());
+        }
+        removeCommonMessages(messageIds);
+        break;
+    }
+    }
+}
+
+void SearchIndex::load()
+{
+    TRACE_SPAN("SearchIndex::load");
+
+    QFile file(m_filePath);
+    if (m_filePath.isEmpty() || !file.open(QFile::ReadOnly)) {
+        return;
+    }
+
+    QDataStream stream(&file);
+    quint32 magic;
+    qint32 version;
+    qint64 userId;
+    stream >> magic >> version >> userId;
+
+    //Another account or format, start over
+    if (magic != SEARCH_INDEX_FILE_MAGIC || version != SEARCH_INDEX_FILE_VERSION || userId != m_userId) {
+        return;
+    }
+
+    qint32 count;
+    stream >> count;
+    for (qint32 i = 0; i < count && stream.status() == QDataStream::Ok; ++i) {
+        Document document;
+        stream >> document.peer >> document.messageId >> document.date >> document.text >> document.tokens;
+        if (stream.status() == QDataStream::Ok) {
+            insert(document);
+        }
+    }
+
+    evict();
+    m_changedTimer.start();
+}
+
+void SearchIndex::save()
+{
+    m_saveTimer.stop();
+
+    if (m_filePath.isEmpty() || m_userId == 0) {
+        return;
+    }
+
+    TRACE_SPAN_ARG("SearchIndex::save", "documents", m_documents.size());
+
+    //Only a snapshot is taken here, the strings are shared with the index.
+    //Oldest first, so the file keeps the order of eviction.
+    QVector<Document> documents;
+    documents.reserve(m_documents.size());
+    for (QMap<qint64, qint32>::const_iterator i = m_byDate.constBegin(); i != m_byDate.constEnd(); ++i) {
+        documents.append(m_documents[i.value()]);
+    }
+
+    QThreadPool::globalInstance()->start(new SearchIndexWriter(m_filePath, m_userId, documents, ++m_saveGeneration));
+}
+
+TgList SearchIndex::memoryUsage() const
+{
+    qint64 documentBytes = 0;
+    for (QHash<qint32, Document>::const_iterator i = m_documents.constBegin(); i != m_documents.constEnd(); ++i) {
+        documentBytes += sizeof(Document) + i.value().text.size() * sizeof(QChar);
+        for (qint32 j = 0; j < i.value().tokens.size(); ++j) {
+            documentBytes += i.value().tokens[j].size() * sizeof(QChar);
+        }
+    }
+
+    qint64 postingEntries = 0;
+    qint64 postingBytes = 0;
+    for (QMap<QString, QSet<qint32> >::const_iterator i = m_postings.constBegin(); i != m_postings.constEnd(); ++i) {
+        postingEntries += i.value().size();
+        postingBytes += i.key().size() * sizeof(QChar) + i.value().size() * sizeof(qint32) * 4;
+    }
+
+    TgList usage;
+    usage << MemoryStats::usage("documents", m_documents.size(), documentBytes);
+    usage << MemoryStats::usage("postings", postingEntries, postingBytes);
+    return usage;
+}
@@ -0,0 +1,92 @@
+#ifndef SEARCHINDEX_H
+#define SEARCHINDEX_H
+
+#include <QObject>
+#include <QHash>
+#include <QMap>
+#include <QSet>
+#include <QTimer>
+#include "tgclient.h"
+#include "memorystats.h"
+
+//On-device inverted index over the text of messages seen in history and updates.
+//Tokens are NFKD normalized, stripped of combining marks and case folded, so
+//"Ёлка" is found by "елка". Postings are kept sorted by token, which makes every
+//query token a prefix lookup. Documents are prepared with prepare() on any
+//thread; the index itself is used from the GUI thread only.
+class SearchIndex : public QObject, public MemoryReporter
+{
+    Q_OBJECT
+
+public:
+    static SearchIndex* instance();
+
+    static QString normalize(QString text);
+    static QStringList tokenize(QString text);
+
+    //Search document of a message, empty for service and empty messages
+    static TgObject prepare(qint64 peer, TgObject message);
+
+    //Binds the index to a file of the authorized account, loading it if it differs
+    void open(QString filePath, qint64 userId);
+    void clear();
+
+    void setMaxDocuments(qint32 count);
+    qint32 maxDocuments() const;
+
+    void addDocument(TgObject document);
+    void addDocuments(TgList documents);
+    void removeMessage(qint64 peer, qint32 messageId);
+    //Message ids of users and basic groups are unique per account, deletes come without a peer
+    void removeCommonMessages(QSet<qint32> messageIds);
+
+    //Document ids matching every query token as a prefix, newest first
+    QList<qint32> search(QString query) const;
+    TgObject document(qint32 documentId) const;
+
+    TgList memoryUsage() const;
+
+    struct Document {
+        qint64 peer;
+        qint32 messageId;
+        qint32 date;
+        QString text;
+        QStringList tokens;
+    };
+
+signals:
+    void changed();
+
+public slots:
+    void gotUpdate(TgObject update);
+    void save();
+
+private:
+    explicit SearchIndex(QObject *parent = 0);
+
+    QString m_filePath;
+    qint64 m_userId;
+    qint32 m_maxDocuments;
+    qint32 m_lastId;
+    //Snapshots handed to SearchIndexWriter, only the newest one is written
+    qint64 m_saveGeneration;
+
+    QHash<qint32, Document> m_documents;
+    QHash<QPair<qint64, qint32>, qint32> m_ids;
+    QMap<QString, QSet<qint32> > m_postings;
+    //date << 32 | document id, the oldest are evicted first
+    QMap<qint64, qint32> m_byDate;
+
+    QTimer m_saveTimer;
+    QTimer m_changedTimer;
+
+    void insert(const Document &document);
+    void remove(qint32 documentId);
+    void evict();
+    void load();
+    void touch();
+
+    QSet<qint32> matches(QString prefix) const;
+};
+
+#endif // SEARCHINDEX_H
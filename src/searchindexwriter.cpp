@@ -0,0 +1,51 @@
+#include "searchindexwriter.h"
+
+#include <QSaveFile>
+#include <QDataStream>
+#include <QDebug>
+#include "tracer.h"
+
+QMutex SearchIndexWriter::s_mutex;
+QHash<QString, qint64> SearchIndexWriter::s_written;
+
+SearchIndexWriter::SearchIndexWriter(QString filePath, qint64 userId, QVector<SearchIndex::Document> documents, qint64 generation)
+    : QRunnable()
+    , m_filePath(filePath)
+    , m_userId(userId)
+    , m_documents(documents)
+    , m_generation(generation)
+{
+    setAutoDelete(true);
+}
+
+void SearchIndexWriter::run()
+{
+    //One writer per file at a time, a newer snapshot may have been written meanwhile
+    QMutexLocker lock(&s_mutex);
+    if (s_written.value(m_filePath) > m_generation) {
+        return;
+    }
+
+    TRACE_SPAN_ARG("SearchIndexWriter::run", "documents", m_documents.size());
+
+    QSaveFile file(m_filePath);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << Q_FUNC_INFO << "can't write" << m_filePath;
+        return;
+    }
+
+    QDataStream stream(&file);
+    stream << (quint32) SEARCH_INDEX_FILE_MAGIC << (qint32) SEARCH_INDEX_FILE_VERSION << m_userId << (qint32) m_documents.size();
+
+    for (qint32 i = 0; i < m_documents.size(); ++i) {
+        const SearchIndex::Document &document = m_documents[i];
+        stream << document.peer << document.messageId << document.date << document.text << document.tokens;
+    }
+
+    if (!file.commit()) {
+        qWarning() << Q_FUNC_INFO << "can't write" << m_filePath;
+        return;
+    }
+
+    s_written.insert(m_filePath, m_generation);
+}
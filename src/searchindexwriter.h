@@ -0,0 +1,34 @@
+#ifndef SEARCHINDEXWRITER_H
+#define SEARCHINDEXWRITER_H
+
+#include <QRunnable>
+#include <QMutex>
+#include <QHash>
+#include <QVector>
+#include <QString>
+#include "searchindex.h"
+
+#define SEARCH_INDEX_FILE_MAGIC 0x53494458
+#define SEARCH_INDEX_FILE_VERSION 1
+
+//Writes a snapshot of the SearchIndex on a QThreadPool thread. The file is
+//replaced atomically through QSaveFile, and a snapshot older than the last
+//one written to the same file is dropped, so overlapping saves never go back.
+class SearchIndexWriter : public QRunnable
+{
+public:
+    SearchIndexWriter(QString filePath, qint64 userId, QVector<SearchIndex::Document> documents, qint64 generation);
+
+    void run();
+
+private:
+    QString m_filePath;
+    qint64 m_userId;
+    QVector<SearchIndex::Document> m_documents;
+    qint64 m_generation;
+
+    static QMutex s_mutex;
+    static QHash<QString, qint64> s_written;
+};
+
+#endif // SEARCHINDEXWRITER_H
@@ -11,17 +11,59 @@ LIBS += -L../libs -lkg
 
 SOURCES += \
     avatardownloader.cpp \
+    cachetrimmer.cpp \
+    diskcachemanager.cpp \
+    downloadmanager.cpp \
     messageutil.cpp \
+    memorystats.cpp \
+    startuptimeline.cpp \
+    tracer.cpp \
+    timeformatter.cpp \
+    mediapreparer.cpp \
+    notificationmanager.cpp \
+    readstatetracker.cpp \
+    searchindex.cpp \
+    searchindexwriter.cpp \
+    updatesequencer.cpp \
+    updatessync.cpp \
+    strippedimageprovider.cpp \
+    models/difflistmodel.cpp \
     models/dialogsmodel.cpp \
+    models/dialogsproxymodel.cpp \
     models/foldersmodel.cpp \
+    models/ingestor.cpp \
+    models/prefixindex.cpp \
+    models/searchresultsmodel.cpp \
     main.cpp \
     models/messagesmodel.cpp
 
 HEADERS += \
     avatardownloader.h \
+    cachetrimmer.h \
+    diskcachemanager.h \
+    downloadmanager.h \
     messageutil.h \
+    memorystats.h \
+    startuptimeline.h \
+    tracer.h \
+    timeformatter.h \
+    mediapreparer.h \
+    notificationmanager.h \
+    readstatetracker.h \
+    searchindex.h \
+    searchindexwriter.h \
+    updatesequencer.h \
+    updatessync.h \
+    strippedimageprovider.h \
+    models/chunkedlist.h \
+    models/difflistmodel.h \
     models/dialogsmodel.h \
+    models/dialogsproxymodel.h \
     models/foldersmodel.h \
+    models/ingestor.h \
+    models/prefixindex.h \
+    models/searchresultsmodel.h \
+    models/spscqueue.h \
     models/messagesmodel.h
 
 SAILFISHAPP_ICONS = 86x86 108x108 128x128 172x172 256x256
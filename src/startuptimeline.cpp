@@ -0,0 +1,97 @@
+#include "startuptimeline.h"
+
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QFile>
+#include <QDebug>
+
+//Last milestone of a cold start, the report is written once it is reached
+#define FINAL_MILESTONE "first_avatar_paint"
+
+StartupTimeline* StartupTimeline::instance()
+{
+    static StartupTimeline* timeline = new StartupTimeline();
+    return timeline;
+}
+
+StartupTimeline::StartupTimeline(QObject *parent)
+    : QObject(parent)
+    , m_timer()
+    , m_target(QString::fromLocal8Bit(qgetenv("SAMOLETIK_STARTUP_TIMELINE")))
+    , m_order()
+    , m_milestones()
+    , m_reported(false)
+{
+    m_timer.start();
+}
+
+bool StartupTimeline::isEnabled() const
+{
+    return !m_target.isEmpty() && !m_reported;
+}
+
+void StartupTimeline::mark(const char *milestone)
+{
+    if (!isEnabled()) {
+        return;
+    }
+
+    mark(QString::fromLatin1(milestone));
+}
+
+void StartupTimeline::mark(QString milestone)
+{
+    if (!isEnabled() || m_milestones.contains(milestone)) {
+        return;
+    }
+
+    m_milestones.insert(milestone, m_timer.nsecsElapsed() / 1000);
+    m_order.append(milestone);
+
+    if (milestone == FINAL_MILESTONE) {
+        report();
+    }
+}
+
+void StartupTimeline::report()
+{
+    if (!isEnabled()) {
+        return;
+    }
+
+    m_reported = true;
+
+    QJsonArray milestones;
+    qint64 previous = 0;
+    for (qint32 i = 0; i < m_order.size(); ++i) {
+        qint64 time = m_milestones.value(m_order[i]);
+
+        QJsonObject milestone;
+        milestone["name"] = m_order[i];
+        milestone["us"] = time;
+        milestone["delta_us"] = time - previous;
+        milestones.append(milestone);
+
+        previous = time;
+    }
+
+    QJsonObject root;
+    root["clock"] = QString(QElapsedTimer::clockType() == QElapsedTimer::MonotonicClock ? "monotonic" : "other");
+    root["milestones"] = milestones;
+
+    QJsonDocument document(root);
+
+    if (m_target == "log") {
+        qDebug().noquote() << "Startup timeline:" << QString::fromUtf8(document.toJson(QJsonDocument::Compact));
+        return;
+    }
+
+    QFile file(m_target);
+    if (!file.open(QFile::WriteOnly | QFile::Truncate)) {
+        qWarning() << "Can't write startup timeline to" << m_target;
+        return;
+    }
+
+    file.write(document.toJson());
+}
@@ -0,0 +1,38 @@
+#ifndef STARTUPTIMELINE_H
+#define STARTUPTIMELINE_H
+
+#include <QObject>
+#include <QElapsedTimer>
+#include <QStringList>
+#include <QHash>
+
+//Monotonic timestamps of cold start milestones, from main() to the first avatar paint.
+//Disabled unless SAMOLETIK_STARTUP_TIMELINE is set: "log" writes one JSON line
+//to the log, any other value is used as a path for a JSON report file.
+class StartupTimeline : public QObject
+{
+    Q_OBJECT
+
+public:
+    static StartupTimeline* instance();
+
+    bool isEnabled() const;
+
+    //For hot C++ call sites, no QString is built once the timeline is off or reported
+    void mark(const char* milestone);
+
+public slots:
+    void mark(QString milestone);
+    void report();
+
+private:
+    explicit StartupTimeline(QObject *parent = 0);
+
+    QElapsedTimer m_timer;
+    QString m_target;
+    QStringList m_order;
+    QHash<QString, qint64> m_milestones;
+    bool m_reported;
+};
+
+#endif // STARTUPTIMELINE_H
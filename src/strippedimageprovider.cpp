@@ -0,0 +1,236 @@
+#include "strippedimageprovider.h"
+
+#include <QMutex>
+#include <QMutexLocker>
+#include <QCache>
+#include <QPainter>
+#include <QBrush>
+
+#define AVATAR_SIZE 160
+#define PHOTO_SIZE 280
+#define BLUR_RADIUS 3
+#define IMAGE_CACHE_SIZE (4 * 1024 * 1024)
+//A stripped preview is a few hundred bytes, this keeps several thousand of them
+#define THUMBNAIL_CACHE_SIZE (1024 * 1024)
+
+//JPEG header shared by all stripped thumbnails, see https://core.telegram.org/api/files#stripped-thumbnails
+static const char STRIPPED_HEADER[] =
+    "\xff\xd8\xff\xe0\x00\x10\x4a\x46\x49\x46\x00\x01\x01\x00\x00\x01"
+    "\x00\x01\x00\x00\xff\xdb\x00\x43\x00\x28\x1c\x1e\x23\x1e\x19\x28"
+    "\x23\x21\x23\x2d\x2b\x28\x30\x3c\x64\x41\x3c\x37\x37\x3c\x7b\x58"
+    "\x5d\x49\x64\x91\x80\x99\x96\x8f\x80\x8c\x8a\xa0\xb4\xe6\xc3\xa0"
+    "\xaa\xda\xad\x8a\x8c\xc8\xff\xcb\xda\xee\xf5\xff\xff\xff\x9b\xc1"
+    "\xff\xff\xff\xfa\xff\xe6\xfd\xff\xf8\xff\xdb\x00\x43\x01\x2b\x2d"
+    "\x2d\x3c\x35\x3c\x76\x41\x41\x76\xf8\xa5\x8c\xa5\xf8\xf8\xf8\xf8"
+    "\xf8\xf8\xf8\xf8\xf8\xf8\xf8\xf8\xf8\xf8\xf8\xf8\xf8\xf8\xf8\xf8"
+    "\xf8\xf8\xf8\xf8\xf8\xf8\xf8\xf8\xf8\xf8\xf8\xf8\xf8\xf8\xf8\xf8"
+    "\xf8\xf8\xf8\xf8\xf8\xf8\xf8\xf8\xf8\xf8\xf8\xf8\xf8\xf8\xff\xc0"
+    "\x00\x11\x08\x00\x00\x00\x00\x03\x01\x22\x00\x02\x11\x01\x03\x11"
+    "\x01\xff\xc4\x00\x1f\x00\x00\x01\x05\x01\x01\x01\x01\x01\x01\x00"
+    "\x00\x00\x00\x00\x00\x00\x00\x01\x02\x03\x04\x05\x06\x07\x08\x09"
+    "\x0a\x0b\xff\xc4\x00\xb5\x10\x00\x02\x01\x03\x03\x02\x04\x03\x05"
+    "\x05\x04\x04\x00\x00\x01\x7d\x01\x02\x03\x00\x04\x11\x05\x12\x21"
+    "\x31\x41\x06\x13\x51\x61\x07\x22\x71\x14\x32\x81\x91\xa1\x08\x23"
+    "\x42\xb1\xc1\x15\x52\xd1\xf0\x24\x33\x62\x72\x82\x09\x0a\x16\x17"
+    "\x18\x19\x1a\x25\x26\x27\x28\x29\x2a\x34\x35\x36\x37\x38\x39\x3a"
+    "\x43\x44\x45\x46\x47\x48\x49\x4a\x53\x54\x55\x56\x57\x58\x59\x5a"
+    "\x63\x64\x65\x66\x67\x68\x69\x6a\x73\x74\x75\x76\x77\x78\x79\x7a"
+    "\x83\x84\x85\x86\x87\x88\x89\x8a\x92\x93\x94\x95\x96\x97\x98\x99"
+    "\x9a\xa2\xa3\xa4\xa5\xa6\xa7\xa8\xa9\xaa\xb2\xb3\xb4\xb5\xb6\xb7"
+    "\xb8\xb9\xba\xc2\xc3\xc4\xc5\xc6\xc7\xc8\xc9\xca\xd2\xd3\xd4\xd5"
+    "\xd6\xd7\xd8\xd9\xda\xe1\xe2\xe3\xe4\xe5\xe6\xe7\xe8\xe9\xea\xf1"
+    "\xf2\xf3\xf4\xf5\xf6\xf7\xf8\xf9\xfa\xff\xc4\x00\x1f\x01\x00\x03"
+    "\x01\x01\x01\x01\x01\x01\x01\x01\x01\x00\x00\x00\x00\x00\x00\x01"
+    "\x02\x03\x04\x05\x06\x07\x08\x09\x0a\x0b\xff\xc4\x00\xb5\x11\x00"
+    "\x02\x01\x02\x04\x04\x03\x04\x07\x05\x04\x04\x00\x01\x02\x77\x00"
+    "\x01\x02\x03\x11\x04\x05\x21\x31\x06\x12\x41\x51\x07\x61\x71\x13"
+    "\x22\x32\x81\x08\x14\x42\x91\xa1\xb1\xc1\x09\x23\x33\x52\xf0\x15"
+    "\x62\x72\xd1\x0a\x16\x24\x34\xe1\x25\xf1\x17\x18\x19\x1a\x26\x27"
+    "\x28\x29\x2a\x35\x36\x37\x38\x39\x3a\x43\x44\x45\x46\x47\x48\x49"
+    "\x4a\x53\x54\x55\x56\x57\x58\x59\x5a\x63\x64\x65\x66\x67\x68\x69"
+    "\x6a\x73\x74\x75\x76\x77\x78\x79\x7a\x82\x83\x84\x85\x86\x87\x88"
+    "\x89\x8a\x92\x93\x94\x95\x96\x97\x98\x99\x9a\xa2\xa3\xa4\xa5\xa6"
+    "\xa7\xa8\xa9\xaa\xb2\xb3\xb4\xb5\xb6\xb7\xb8\xb9\xba\xc2\xc3\xc4"
+    "\xc5\xc6\xc7\xc8\xc9\xca\xd2\xd3\xd4\xd5\xd6\xd7\xd8\xd9\xda\xe2"
+    "\xe3\xe4\xe5\xe6\xe7\xe8\xe9\xea\xf2\xf3\xf4\xf5\xf6\xf7\xf8\xf9"
+    "\xfa\xff\xda\x00\x0c\x03\x01\x00\x02\x11\x03\x11\x00\x3f\x00";
+
+#define STRIPPED_HEADER_SIZE 623
+
+static QMutex s_mutex;
+//Bounded as well, placeholders of rows no longer shown are never removed otherwise
+static QCache<QString, QByteArray> s_thumbnails(THUMBNAIL_CACHE_SIZE);
+static QCache<QString, QImage> s_images(IMAGE_CACHE_SIZE);
+
+StrippedImageProvider::StrippedImageProvider()
+    : QQuickImageProvider(QQuickImageProvider::Image, QQmlImageProviderBase::ForceAsynchronousImageLoading)
+    , MemoryReporter("StrippedImageProvider")
+{
+}
+
+TgList StrippedImageProvider::memoryUsage() const
+{
+    QMutexLocker lock(&s_mutex);
+
+    //Cache costs are the key and preview bytes, and the decoded image size in bytes
+    TgList usage;
+    usage << MemoryStats::usage("thumbnails", s_thumbnails.count(), s_thumbnails.totalCost());
+    usage << MemoryStats::usage("decodedImages", s_images.count(), s_images.totalCost());
+    return usage;
+}
+
+QString StrippedImageProvider::addAvatar(qint64 photoId, QByteArray stripped)
+{
+    if (photoId == 0 || stripped.size() < 3) {
+        return "";
+    }
+
+    QString id = "avatar/" + QString::number(photoId);
+
+    QMutexLocker lock(&s_mutex);
+    if (!s_thumbnails.contains(id)) {
+        s_thumbnails.insert(id, new QByteArray(stripped), id.size() * sizeof(QChar) + stripped.size());
+    }
+
+    return "image://stripped/" + id;
+}
+
+QString StrippedImageProvider::addPhoto(qint64 photoId, QByteArray stripped)
+{
+    if (photoId == 0 || stripped.size() < 3) {
+        return "";
+    }
+
+    QString id = "photo/" + QString::number(photoId);
+
+    QMutexLocker lock(&s_mutex);
+    if (!s_thumbnails.contains(id)) {
+        s_thumbnails.insert(id, new QByteArray(stripped), id.size() * sizeof(QChar) + stripped.size());
+    }
+
+    return "image://stripped/" + id;
+}
+
+void StrippedImageProvider::remove(QString url)
+{
+    QString id = url.mid(QString("image://stripped/").length());
+
+    QMutexLocker lock(&s_mutex);
+    s_thumbnails.remove(id);
+    s_images.remove(id);
+}
+
+QImage StrippedImageProvider::requestImage(const QString &id, QSize *size, const QSize &requestedSize)
+{
+    QByteArray stripped;
+    {
+        QMutexLocker lock(&s_mutex);
+
+        QImage* cached = s_images.object(id);
+        if (cached) {
+            if (size) {
+                *size = cached->size();
+            }
+            return *cached;
+        }
+
+        QByteArray* thumbnail = s_thumbnails.object(id);
+        if (thumbnail) {
+            stripped = *thumbnail;
+        }
+    }
+
+    QImage image = decode(stripped);
+    if (image.isNull()) {
+        return image;
+    }
+
+    if (id.startsWith("avatar/")) {
+        QImage roundedImage(AVATAR_SIZE, AVATAR_SIZE, QImage::Format_ARGB32);
+        roundedImage.fill(Qt::transparent);
+
+        QPainter painter(&roundedImage);
+        painter.setRenderHint(QPainter::Antialiasing);
+        painter.setBrush(QBrush(blur(image.scaled(AVATAR_SIZE, AVATAR_SIZE, Qt::IgnoreAspectRatio, Qt::SmoothTransformation), BLUR_RADIUS)));
+        painter.setPen(Qt::transparent);
+        painter.drawRoundedRect(0, 0, AVATAR_SIZE, AVATAR_SIZE, AVATAR_SIZE / 2, AVATAR_SIZE / 2);
+        painter.end();
+
+        image = roundedImage;
+    } else {
+        QSize target = requestedSize.isValid() ? requestedSize : image.size().scaled(PHOTO_SIZE, PHOTO_SIZE, Qt::KeepAspectRatio);
+        image = blur(image.scaled(target, Qt::KeepAspectRatio, Qt::SmoothTransformation), BLUR_RADIUS);
+    }
+
+    if (size) {
+        *size = image.size();
+    }
+
+    QMutexLocker lock(&s_mutex);
+    s_images.insert(id, new QImage(image), image.byteCount());
+
+    return image;
+}
+
+QImage StrippedImageProvider::decode(QByteArray stripped)
+{
+    if (stripped.size() < 3 || stripped[0] != 1) {
+        return QImage();
+    }
+
+    QByteArray jpeg(STRIPPED_HEADER, STRIPPED_HEADER_SIZE);
+    jpeg[164] = stripped[1];
+    jpeg[166] = stripped[2];
+    jpeg.append(stripped.mid(3));
+    jpeg.append("\xff\xd9", 2);
+
+    return QImage::fromData(jpeg, "JPEG");
+}
+
+QImage StrippedImageProvider::blur(QImage image, qint32 radius)
+{
+    //Two box blur passes, good enough to hide JPEG blocks of a 40px preview
+    image = image.convertToFormat(QImage::Format_ARGB32);
+    qint32 width = image.width();
+    qint32 height = image.height();
+
+    for (qint32 pass = 0; pass < 2; ++pass) {
+        QImage source = image;
+
+        for (qint32 y = 0; y < height; ++y) {
+            const QRgb* in = reinterpret_cast<const QRgb*>(source.constScanLine(y));
+            QRgb* out = reinterpret_cast<QRgb*>(image.scanLine(y));
+
+            for (qint32 x = 0; x < width; ++x) {
+                qint32 r = 0, g = 0, b = 0, a = 0, count = 0;
+                for (qint32 i = qMax(0, x - radius); i <= qMin(width - 1, x + radius); ++i) {
+                    r += qRed(in[i]);
+                    g += qGreen(in[i]);
+                    b += qBlue(in[i]);
+                    a += qAlpha(in[i]);
+                    ++count;
+                }
+                out[x] = qRgba(r / count, g / count, b / count, a / count);
+            }
+        }
+
+        source = image;
+
+        for (qint32 x = 0; x < width; ++x) {
+            for (qint32 y = 0; y < height; ++y) {
+                qint32 r = 0, g = 0, b = 0, a = 0, count = 0;
+                for (qint32 i = qMax(0, y - radius); i <= qMin(height - 1, y + radius); ++i) {
+                    QRgb pixel = reinterpret_cast<const QRgb*>(source.constScanLine(i))[x];
+                    r += qRed(pixel);
+                    g += qGreen(pixel);
+                    b += qBlue(pixel);
+                    a += qAlpha(pixel);
+                    ++count;
+                }
+                reinterpret_cast<QRgb*>(image.scanLine(y))[x] = qRgba(r / count, g / count, b / count, a / count);
+            }
+        }
+    }
+
+    return image;
+}
@@ -0,0 +1,28 @@
+#ifndef STRIPPEDIMAGEPROVIDER_H
+#define STRIPPEDIMAGEPROVIDER_H
+
+#include <QQuickImageProvider>
+#include <QImage>
+#include "memorystats.h"
+
+//Serves blurred placeholders decoded from the tiny "stripped" previews Telegram
+//sends inline with users, chats and photos, as image://stripped/<kind>/<id>.
+//Decoding happens on the QML image loader thread.
+class StrippedImageProvider : public QQuickImageProvider, public MemoryReporter
+{
+public:
+    StrippedImageProvider();
+
+    QImage requestImage(const QString &id, QSize *size, const QSize &requestedSize);
+
+    TgList memoryUsage() const;
+
+    static QString addAvatar(qint64 photoId, QByteArray stripped);
+    static QString addPhoto(qint64 photoId, QByteArray stripped);
+    static void remove(QString url);
+
+    static QImage decode(QByteArray stripped);
+    static QImage blur(QImage image, qint32 radius);
+};
+
+#endif // STRIPPEDIMAGEPROVIDER_H
@@ -0,0 +1,183 @@
+#include "timeformatter.h"
+
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QEvent>
+
+#define SECONDS_PER_DAY 86400
+//UTC offsets are cached per quarter hour, see offsetFromUtc()
+#define OFFSET_SLOT_SECONDS 900
+//Upper bound between checks, catches timezone and DST changes without a system signal
+#define MAX_REFRESH_INTERVAL (60 * 60 * 1000)
+#define WEEKDAY_LABEL_DAYS 6
+
+TimeFormatter* TimeFormatter::instance()
+{
+    static TimeFormatter* formatter = new TimeFormatter();
+    return formatter;
+}
+
+TimeFormatter::TimeFormatter(QObject *parent)
+    : QObject(parent)
+    , m_timer()
+    , m_locale(QLocale::system())
+    , m_use24HourClock(!QLocale::system().timeFormat(QLocale::ShortFormat).contains("ap", Qt::CaseInsensitive))
+    , m_currentOffset(0)
+    , m_today(0)
+    , m_offsets()
+    , m_clockCache()
+    , m_dayCache()
+{
+    m_timer.setSingleShot(true);
+    connect(&m_timer, SIGNAL(timeout()), this, SLOT(refresh()));
+
+    if (QCoreApplication::instance()) {
+        QCoreApplication::instance()->installEventFilter(this);
+    }
+
+    refresh(true);
+}
+
+bool TimeFormatter::use24HourClock() const
+{
+    return m_use24HourClock;
+}
+
+void TimeFormatter::setUse24HourClock(bool use24HourClock)
+{
+    if (m_use24HourClock == use24HourClock) {
+        return;
+    }
+
+    m_use24HourClock = use24HourClock;
+    emit use24HourClockChanged();
+    refresh(true);
+}
+
+bool TimeFormatter::eventFilter(QObject *watched, QEvent *event)
+{
+    if (watched == QCoreApplication::instance()
+            && (event->type() == QEvent::LocaleChange || event->type() == QEvent::TimezoneChange)) {
+        refresh(true);
+    }
+
+    return QObject::eventFilter(watched, event);
+}
+
+void TimeFormatter::refresh(bool force)
+{
+    QDateTime now = QDateTime::currentDateTime();
+    qint32 currentOffset = now.offsetFromUtc();
+    qint64 today = (now.toTime_t() + (qint64) currentOffset) / SECONDS_PER_DAY;
+
+    if (force || currentOffset != m_currentOffset) {
+        m_locale = QLocale::system();
+        m_offsets.clear();
+        m_clockCache.clear();
+        m_dayCache.clear();
+    } else if (today != m_today) {
+        //Only relative labels move at midnight, clock times stay valid
+        m_dayCache.clear();
+    }
+
+    bool changed = force || currentOffset != m_currentOffset || today != m_today;
+    m_currentOffset = currentOffset;
+    m_today = today;
+
+    scheduleRefresh();
+
+    if (changed) {
+        emit this->changed();
+    }
+}
+
+void TimeFormatter::scheduleRefresh()
+{
+    QDateTime now = QDateTime::currentDateTime();
+    qint64 untilMidnight = now.msecsTo(QDateTime(now.date().addDays(1), QTime(0, 0))) + 1000;
+
+    m_timer.start(qBound<qint64>(1000, untilMidnight, MAX_REFRESH_INTERVAL));
+}
+
+qint32 TimeFormatter::offsetFromUtc(qint32 date)
+{
+    //DST may differ from today's offset. A switch happens on a quarter hour in UTC
+    //(whole or half hour zones included), so one lookup per slot is exact.
+    qint64 slot = date / OFFSET_SLOT_SECONDS;
+
+    QHash<qint64, qint32>::const_iterator i = m_offsets.constFind(slot);
+    if (i != m_offsets.constEnd()) {
+        return i.value();
+    }
+
+    qint32 offset = QDateTime::fromTime_t(date).offsetFromUtc();
+    m_offsets.insert(slot, offset);
+
+    return offset;
+}
+
+qint64 TimeFormatter::localDay(qint32 date, qint32 *minuteOfDay)
+{
+    qint64 local = (qint64) date + offsetFromUtc(date);
+
+    if (minuteOfDay) {
+        *minuteOfDay = (local % SECONDS_PER_DAY) / 60;
+    }
+
+    return local / SECONDS_PER_DAY;
+}
+
+QString TimeFormatter::messageTime(qint32 date)
+{
+    if (date <= 0) {
+        return QString();
+    }
+
+    qint32 minuteOfDay = 0;
+    localDay(date, &minuteOfDay);
+
+    QHash<qint32, QString>::const_iterator i = m_clockCache.constFind(minuteOfDay);
+    if (i != m_clockCache.constEnd()) {
+        return i.value();
+    }
+
+    QTime time(minuteOfDay / 60, minuteOfDay % 60);
+    QString text = m_locale.toString(time, m_use24HourClock ? "HH:mm" : "h:mm AP");
+    m_clockCache.insert(minuteOfDay, text);
+
+    return text;
+}
+
+QString TimeFormatter::dialogTime(qint32 date)
+{
+    if (date <= 0) {
+        return QString();
+    }
+
+    qint64 day = localDay(date, 0);
+    if (day >= m_today) {
+        return messageTime(date);
+    }
+
+    QHash<qint64, QString>::const_iterator i = m_dayCache.constFind(day);
+    if (i != m_dayCache.constEnd()) {
+        return i.value();
+    }
+
+    QDate localDate = QDateTime::fromTime_t(date).date();
+    QString text;
+
+    if (day == m_today - 1) {
+        text = tr("Yesterday");
+    } else if (m_today - day <= WEEKDAY_LABEL_DAYS) {
+        text = m_locale.dayName(localDate.dayOfWeek(), QLocale::ShortFormat);
+    } else if (localDate.year() == QDate::currentDate().year()) {
+        text = m_locale.toString(localDate, "d MMM");
+    } else {
+        text = m_locale.toString(localDate, QLocale::ShortFormat);
+    }
+
+    m_dayCache.insert(day, text);
+
+    return text;
+}
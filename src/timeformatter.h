@@ -0,0 +1,56 @@
+#ifndef TIMEFORMATTER_H
+#define TIMEFORMATTER_H
+
+#include <QObject>
+#include <QHash>
+#include <QTimer>
+#include <QLocale>
+
+//Formats message timestamps for all models. Results are cached per minute of day
+//and per day bucket, so a row costs a couple of hash lookups. One timer fires at
+//local midnight (and hourly to catch timezone or DST changes); changed() is then
+//emitted and models refresh only their time role.
+class TimeFormatter : public QObject
+{
+    Q_OBJECT
+    Q_PROPERTY(bool use24HourClock READ use24HourClock WRITE setUse24HourClock NOTIFY use24HourClockChanged)
+
+public:
+    static TimeFormatter* instance();
+
+    bool use24HourClock() const;
+    void setUse24HourClock(bool use24HourClock);
+
+    //Clock time, for message bubbles
+    QString messageTime(qint32 date);
+    //Clock time today, "Yesterday", weekday or date further back, for the dialog list
+    QString dialogTime(qint32 date);
+
+    bool eventFilter(QObject *watched, QEvent *event);
+
+signals:
+    void changed();
+    void use24HourClockChanged();
+
+public slots:
+    void refresh(bool force = false);
+
+private:
+    explicit TimeFormatter(QObject *parent = 0);
+
+    qint32 offsetFromUtc(qint32 date);
+    qint64 localDay(qint32 date, qint32 *minuteOfDay);
+    void scheduleRefresh();
+
+    QTimer m_timer;
+    QLocale m_locale;
+    bool m_use24HourClock;
+    qint32 m_currentOffset;
+    qint64 m_today;
+
+    QHash<qint64, qint32> m_offsets;
+    QHash<qint32, QString> m_clockCache;
+    QHash<qint64, QString> m_dayCache;
+};
+
+#endif // TIMEFORMATTER_H
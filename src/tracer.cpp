@@ -0,0 +1,167 @@
+#include "tracer.h"
+
+#include <QDebug>
+
+#define WRITER_INTERVAL_MS 200
+
+QAtomicInt Tracer::s_enabled(0);
+
+Tracer* Tracer::instance()
+{
+    static Tracer* tracer = new Tracer();
+    return tracer;
+}
+
+Tracer::Tracer(QObject *parent)
+    : QObject(parent)
+    , m_timer()
+    , m_events(0)
+    , m_head(0)
+    , m_tail(0)
+    , m_dropped(0)
+    , m_file()
+    , m_writer(0)
+{
+    m_timer.start();
+
+    QString filePath = QString::fromLocal8Bit(qgetenv("SAMOLETIK_TRACE"));
+    if (!filePath.isEmpty()) {
+        start(filePath);
+    }
+}
+
+void Tracer::record(char phase, const char* name, const char* argName, qint64 argValue, qint64 id)
+{
+    Tracer* tracer = instance();
+
+    //Claim a slot, drop the event if the writer fell a whole ring behind.
+    //Capacity is checked before the claim, a claimed slot is always written,
+    //otherwise drain() would wait for it forever.
+    quint32 sequence;
+    do {
+        sequence = tracer->m_head.loadAcquire();
+        if (sequence - tracer->m_tail.loadAcquire() >= TRACE_RING_SIZE) {
+            tracer->m_dropped.fetchAndAddRelaxed(1);
+            return;
+        }
+    } while (!tracer->m_head.testAndSetOrdered(sequence, sequence + 1));
+
+    Event &event = tracer->m_events[sequence % TRACE_RING_SIZE];
+    event.phase = phase;
+    event.name = name;
+    event.argName = argName;
+    event.argValue = argValue;
+    event.id = id;
+    event.time = tracer->m_timer.nsecsElapsed() / 1000;
+    event.thread = (quintptr) QThread::currentThreadId();
+    event.ready.storeRelease(1);
+}
+
+void Tracer::drain()
+{
+    quint32 tail = m_tail.loadAcquire();
+    QByteArray chunk;
+
+    while (tail != m_head.loadAcquire()) {
+        Event &event = m_events[tail % TRACE_RING_SIZE];
+
+        //Claimed but not written yet, continue from here next time
+        if (!event.ready.loadAcquire()) {
+            break;
+        }
+
+        chunk += "{\"name\":\"";
+        chunk += event.name;
+        chunk += "\",\"cat\":\"samoletik\",\"ph\":\"";
+        chunk += event.phase;
+        chunk += "\",\"ts\":" + QByteArray::number(event.time);
+        chunk += ",\"pid\":1,\"tid\":" + QByteArray::number((qulonglong) event.thread);
+        if (event.phase == 'b' || event.phase == 'e') {
+            chunk += ",\"id\":" + QByteArray::number(event.id);
+        }
+        if (event.argName) {
+            chunk += ",\"args\":{\"";
+            chunk += event.argName;
+            chunk += "\":" + QByteArray::number(event.argValue) + "}";
+        }
+        chunk += "},\n";
+
+        event.ready.storeRelease(0);
+        m_tail.storeRelease(++tail);
+    }
+
+    if (!chunk.isEmpty() && m_file.isOpen()) {
+        m_file.write(chunk);
+        m_file.flush();
+    }
+}
+
+bool Tracer::start(QString filePath)
+{
+    if (m_writer) {
+        stop();
+    }
+
+    m_file.setFileName(filePath);
+    if (!m_file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qWarning() << "Tracer: can't open" << filePath;
+        return false;
+    }
+
+    //JSON array format, the closing bracket is optional for trace viewers
+    m_file.write("[\n");
+
+    //Allocated on first use and kept, late producers may still hold a slot
+    if (!m_events) {
+        m_events = new Event[TRACE_RING_SIZE];
+    }
+    for (qint32 i = 0; i < TRACE_RING_SIZE; ++i) {
+        m_events[i].ready.storeRelease(0);
+    }
+
+    m_tail.storeRelease(m_head.loadAcquire());
+    m_dropped.storeRelease(0);
+
+    m_writer = new Writer(this);
+    m_writer->start(QThread::LowPriority);
+
+    s_enabled.storeRelease(1);
+    return true;
+}
+
+void Tracer::stop()
+{
+    if (!m_writer) {
+        return;
+    }
+
+    s_enabled.storeRelease(0);
+
+    m_writer->running.storeRelease(0);
+    m_writer->wait();
+    delete m_writer;
+    m_writer = 0;
+
+    drain();
+
+    if (m_dropped.loadAcquire()) {
+        qWarning() << "Tracer: dropped" << m_dropped.loadAcquire() << "events";
+    }
+
+    m_file.close();
+}
+
+Tracer::Writer::Writer(Tracer *tracer)
+    : QThread()
+    , running(1)
+    , m_tracer(tracer)
+{
+}
+
+void Tracer::Writer::run()
+{
+    while (running.loadAcquire()) {
+        m_tracer->drain();
+        msleep(WRITER_INTERVAL_MS);
+    }
+}
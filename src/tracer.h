@@ -0,0 +1,107 @@
+#ifndef TRACER_H
+#define TRACER_H
+
+#include <QObject>
+#include <QAtomicInteger>
+#include <QElapsedTimer>
+#include <QThread>
+#include <QFile>
+
+#define TRACE_RING_SIZE 16384
+
+//Span tracing in Chrome trace JSON (load the file in Perfetto or chrome://tracing).
+//Switched on by SAMOLETIK_TRACE=<path> or tracer.start(path) from QML. Producers
+//only write into a lock-free ring, a writer thread formats and flushes it.
+//When tracing is off every hook is a single relaxed atomic load.
+class Tracer : public QObject
+{
+    Q_OBJECT
+
+public:
+    static Tracer* instance();
+
+    static inline bool isEnabled()
+    {
+        return s_enabled.load();
+    }
+
+    static void record(char phase, const char* name, const char* argName = 0, qint64 argValue = 0, qint64 id = 0);
+
+    void drain();
+
+public slots:
+    bool start(QString filePath);
+    void stop();
+
+private:
+    struct Event {
+        QAtomicInt ready;
+        char phase;
+        const char* name;
+        const char* argName;
+        qint64 argValue;
+        qint64 id;
+        qint64 time;
+        quintptr thread;
+    };
+
+    class Writer : public QThread
+    {
+    public:
+        explicit Writer(Tracer* tracer);
+        void run();
+
+        QAtomicInt running;
+
+    private:
+        Tracer* m_tracer;
+    };
+
+    explicit Tracer(QObject *parent = 0);
+
+    static QAtomicInt s_enabled;
+
+    QElapsedTimer m_timer;
+    Event* m_events;
+    QAtomicInteger<quint32> m_head;
+    QAtomicInteger<quint32> m_tail;
+    QAtomicInteger<quint32> m_dropped;
+
+    QFile m_file;
+    Writer* m_writer;
+};
+
+//Begin and end events around the enclosing scope
+class TraceSpan
+{
+public:
+    inline TraceSpan(const char* name, const char* argName = 0, qint64 argValue = 0)
+        : m_name(Tracer::isEnabled() ? name : 0)
+    {
+        if (m_name) {
+            Tracer::record('B', m_name, argName, argValue);
+        }
+    }
+
+    inline ~TraceSpan()
+    {
+        if (m_name) {
+            Tracer::record('E', m_name);
+        }
+    }
+
+private:
+    const char* m_name;
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+
+#define TRACE_SPAN(name) TraceSpan TRACE_CONCAT(traceSpan, __LINE__)(name)
+#define TRACE_SPAN_ARG(name, argName, argValue) TraceSpan TRACE_CONCAT(traceSpan, __LINE__)(name, argName, argValue)
+
+//Async events paired by TgClient request id, from issue to response
+#define TRACE_REQUEST_ISSUED(name, requestId) do { if (Tracer::isEnabled()) Tracer::record('b', name, 0, 0, requestId); } while (0)
+#define TRACE_REQUEST_FINISHED(name, requestId) do { if (Tracer::isEnabled()) Tracer::record('e', name, 0, 0, requestId); } while (0)
+
+#endif // TRACER_H
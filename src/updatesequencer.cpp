@@ -0,0 +1,325 @@
+#include "updatesequencer.h"
+
+#include <QDateTime>
+#include "tlschema.h"
+#include "tracer.h"
+
+//Telegram suggests about half a second before treating a hole as a real gap
+#define DEFAULT_HOLD_TIMEOUT 500
+#define SEQ_KEY -1
+#define UNORDERED_KEY -2
+
+UpdateSequencer::UpdateSequencer(QObject *parent)
+    : QObject(parent)
+    , m_pts(0)
+    , m_seq(0)
+    , m_seqStart(0)
+    , m_channelPts()
+    , m_held()
+    , m_holdTimer()
+    , m_holdTimeout(DEFAULT_HOLD_TIMEOUT)
+    , m_applied(0)
+    , m_duplicates(0)
+    , m_reordered(0)
+    , m_gaps(0)
+{
+    m_holdTimer.setSingleShot(true);
+    connect(&m_holdTimer, SIGNAL(timeout()), this, SLOT(checkHeld()));
+}
+
+void UpdateSequencer::reset()
+{
+    m_pts = 0;
+    m_seq = 0;
+    m_seqStart = 0;
+    m_channelPts.clear();
+    m_held.clear();
+    m_holdTimer.stop();
+}
+
+void UpdateSequencer::setState(qint32 pts, qint32 seq)
+{
+    m_pts = pts;
+    m_seq = seq;
+    m_seqStart = 0;
+
+    //Held updates are either covered by the new state or follow it now
+    drain(0);
+    drain(SEQ_KEY);
+}
+
+qint32 UpdateSequencer::pts() const
+{
+    return m_pts;
+}
+
+qint32 UpdateSequencer::seq() const
+{
+    return m_seq;
+}
+
+void UpdateSequencer::setChannelPts(qint64 channelId, qint32 pts)
+{
+    m_channelPts.insert(channelId, pts);
+    drain(channelId);
+}
+
+qint32 UpdateSequencer::channelPts(qint64 channelId) const
+{
+    return m_channelPts.value(channelId);
+}
+
+bool UpdateSequencer::hasChannel(qint64 channelId) const
+{
+    return m_channelPts.contains(channelId);
+}
+
+void UpdateSequencer::removeChannel(qint64 channelId)
+{
+    m_channelPts.remove(channelId);
+    m_held.remove(channelId);
+}
+
+void UpdateSequencer::setHoldTimeout(qint32 timeout)
+{
+    m_holdTimeout = qMax(timeout, 0);
+}
+
+qint32 UpdateSequencer::holdTimeout() const
+{
+    return m_holdTimeout;
+}
+
+TgObject UpdateSequencer::stats() const
+{
+    qint32 held = 0;
+    for (QHash<qint64, QList<Held> >::const_iterator i = m_held.constBegin(); i != m_held.constEnd(); ++i) {
+        held += i.value().size();
+    }
+
+    TgObject stats;
+    stats["applied"] = m_applied;
+    stats["duplicates"] = m_duplicates;
+    stats["reordered"] = m_reordered;
+    stats["gaps"] = m_gaps;
+    stats["held"] = held;
+    return stats;
+}
+
+qint64 UpdateSequencer::channelId(TgObject update)
+{
+    if (update.contains("channel_id")) {
+        return update["channel_id"].toLongLong();
+    }
+
+    TgObject peer = update["message"].toMap()["peer_id"].toMap();
+    if (TgClient::isChannel(peer)) {
+        return TgClient::getPeerId(peer).toLongLong();
+    }
+
+    return 0;
+}
+
+qint64 UpdateSequencer::sequenceKey(TgObject update, qint32 seq)
+{
+    //Updates which change pts come with pts_count, the rest of pts carrying ones
+    //(read inbox of channels and alike) only report the current value
+    if (update.contains("pts_count")) {
+        return channelId(update);
+    }
+
+    if (seq > 0) {
+        return SEQ_KEY;
+    }
+
+    return UNORDERED_KEY;
+}
+
+qint32 UpdateSequencer::position(qint64 key, const Held &held) const
+{
+    if (key == SEQ_KEY) {
+        qint32 seqStart = held.seqStart > 0 ? held.seqStart : held.seq;
+
+        //Every update of the container that was just applied shares its seq
+        if (m_seq == 0 || (held.seq == m_seq && seqStart == m_seqStart)) {
+            return 0;
+        }
+        if (seqStart <= m_seq) {
+            return -1;
+        }
+        return seqStart == m_seq + 1 ? 0 : 1;
+    }
+
+    qint32 local = key == 0 ? m_pts : m_channelPts.value(key);
+    qint32 pts = held.update["pts"].toInt();
+    qint32 ptsCount = held.update["pts_count"].toInt();
+
+    //Nothing known yet, the first update sets the base
+    if (local == 0) {
+        return 0;
+    }
+    if (local + ptsCount > pts) {
+        return -1;
+    }
+    return local + ptsCount == pts ? 0 : 1;
+}
+
+void UpdateSequencer::push(TgObject update, TgLongVariant messageId, TgList users, TgList chats, qint32 date, qint32 seq, qint32 seqStart)
+{
+    Held held;
+    held.update = update;
+    held.messageId = messageId;
+    held.users = users;
+    held.chats = chats;
+    held.date = date;
+    held.seq = seq;
+    held.seqStart = seqStart;
+    held.heldAt = 0;
+
+    qint64 key = sequenceKey(update, seq);
+    if (key == UNORDERED_KEY) {
+        apply(key, held);
+        return;
+    }
+
+    //Keep the order behind anything already waiting for the same sequence
+    if (!m_held.value(key).isEmpty()) {
+        hold(key, held);
+        drain(key);
+        if (key != SEQ_KEY && seq > 0) {
+            drain(SEQ_KEY);
+        }
+        return;
+    }
+
+    switch (position(key, held)) {
+    case -1:
+        ++m_duplicates;
+        break;
+    case 0:
+        apply(key, held);
+        drain(key);
+        break;
+    default:
+        hold(key, held);
+        break;
+    }
+
+    //Seq ordered updates may wait for this container
+    if (key != SEQ_KEY && seq > 0) {
+        drain(SEQ_KEY);
+    }
+}
+
+void UpdateSequencer::apply(qint64 key, const Held &held)
+{
+    if (key == SEQ_KEY) {
+        m_seq = held.seq;
+        m_seqStart = held.seqStart > 0 ? held.seqStart : held.seq;
+    } else if (key >= 0) {
+        qint32 pts = held.update["pts"].toInt();
+        if (key == 0) {
+            m_pts = pts;
+        } else {
+            m_channelPts.insert(key, pts);
+        }
+
+        //The container seq counts even if all of its updates are pts ordered,
+        //unless it skips a container that may still hold seq ordered updates
+        qint32 seqStart = held.seqStart > 0 ? held.seqStart : held.seq;
+        if (held.seq > m_seq && (m_seq == 0 || seqStart <= m_seq + 1)) {
+            m_seq = held.seq;
+            m_seqStart = seqStart;
+        }
+    }
+
+    ++m_applied;
+    emit gotUpdate(held.update, held.messageId, held.users, held.chats, held.date, held.seq, held.seqStart);
+}
+
+void UpdateSequencer::hold(qint64 key, const Held &held)
+{
+    Held entry = held;
+    entry.heldAt = QDateTime::currentMSecsSinceEpoch();
+
+    //Ordered by where the update starts, so drain() only has to look at the front
+    QList<Held> &queue = m_held[key];
+    qint32 start = key == SEQ_KEY ? (held.seqStart > 0 ? held.seqStart : held.seq)
+                                  : held.update["pts"].toInt() - held.update["pts_count"].toInt();
+    qint32 i = queue.size();
+    while (i > 0) {
+        const Held &prev = queue[i - 1];
+        qint32 prevStart = key == SEQ_KEY ? (prev.seqStart > 0 ? prev.seqStart : prev.seq)
+                                          : prev.update["pts"].toInt() - prev.update["pts_count"].toInt();
+        if (prevStart <= start) {
+            break;
+        }
+        --i;
+    }
+    queue.insert(i, entry);
+
+    if (!m_holdTimer.isActive()) {
+        m_holdTimer.start(m_holdTimeout);
+    }
+}
+
+void UpdateSequencer::drain(qint64 key)
+{
+    QHash<qint64, QList<Held> >::iterator queue = m_held.find(key);
+    if (queue == m_held.end()) {
+        return;
+    }
+
+    while (!queue->isEmpty()) {
+        qint32 result = position(key, queue->first());
+        if (result > 0) {
+            return;
+        }
+
+        Held held = queue->takeFirst();
+        if (result < 0) {
+            ++m_duplicates;
+        } else {
+            ++m_reordered;
+            apply(key, held);
+        }
+    }
+
+    m_held.erase(queue);
+}
+
+void UpdateSequencer::checkHeld()
+{
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    qint64 nextCheck = -1;
+
+    QList<qint64> keys = m_held.keys();
+    for (qint32 i = 0; i < keys.size(); ++i) {
+        const QList<Held> &queue = m_held[keys[i]];
+        if (queue.isEmpty()) {
+            continue;
+        }
+
+        qint64 oldest = queue.first().heldAt;
+        for (qint32 j = 1; j < queue.size(); ++j) {
+            oldest = qMin(oldest, queue[j].heldAt);
+        }
+
+        qint64 left = oldest + m_holdTimeout - now;
+        if (left > 0) {
+            nextCheck = nextCheck < 0 ? left : qMin(nextCheck, left);
+            continue;
+        }
+
+        //The hole was not filled in time. The difference covers the held updates too.
+        ++m_gaps;
+        TRACE_SPAN_ARG("UpdateSequencer::gap", "channel", keys[i]);
+
+        m_held.remove(keys[i]);
+        emit gapDetected(keys[i] == SEQ_KEY ? 0 : keys[i]);
+    }
+
+    if (nextCheck >= 0) {
+        m_holdTimer.start(nextCheck);
+    }
+}
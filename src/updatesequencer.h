@@ -0,0 +1,86 @@
+#ifndef UPDATESEQUENCER_H
+#define UPDATESEQUENCER_H
+
+#include <QObject>
+#include <QHash>
+#include <QTimer>
+#include "tgclient.h"
+
+//Puts live updates back in order before the models see them.
+//Updates carrying pts/pts_count are checked against the common or the channel pts,
+//the rest against seq of their container. Duplicates are dropped, an update from
+//the future is held back for a short while, and if the hole is not filled in time
+//gapDetected() asks for a difference.
+class UpdateSequencer : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit UpdateSequencer(QObject *parent = 0);
+
+    void reset();
+
+    void setState(qint32 pts, qint32 seq);
+    qint32 pts() const;
+    qint32 seq() const;
+
+    void setChannelPts(qint64 channelId, qint32 pts);
+    qint32 channelPts(qint64 channelId) const;
+    bool hasChannel(qint64 channelId) const;
+    void removeChannel(qint64 channelId);
+
+    void setHoldTimeout(qint32 timeout);
+    qint32 holdTimeout() const;
+
+    void push(TgObject update, TgLongVariant messageId, TgList users, TgList chats, qint32 date, qint32 seq, qint32 seqStart);
+
+    TgObject stats() const;
+
+    //Channel an update belongs to, 0 for the common sequence
+    static qint64 channelId(TgObject update);
+
+signals:
+    void gotUpdate(TgObject update, TgLongVariant messageId, TgList users, TgList chats, qint32 date, qint32 seq, qint32 seqStart);
+    //channelId is 0 for the common pts/seq sequence
+    void gapDetected(qint64 channelId);
+
+public slots:
+    void checkHeld();
+
+private:
+    struct Held {
+        TgObject update;
+        TgLongVariant messageId;
+        TgList users;
+        TgList chats;
+        qint32 date;
+        qint32 seq;
+        qint32 seqStart;
+        qint64 heldAt;
+    };
+
+    qint32 m_pts;
+    qint32 m_seq;
+    qint32 m_seqStart;
+    QHash<qint64, qint32> m_channelPts;
+
+    //Keyed by channel id, 0 for common pts and SEQ_KEY for seq ordered updates
+    QHash<qint64, QList<Held> > m_held;
+    QTimer m_holdTimer;
+    qint32 m_holdTimeout;
+
+    qint64 m_applied;
+    qint64 m_duplicates;
+    qint64 m_reordered;
+    qint64 m_gaps;
+
+    static qint64 sequenceKey(TgObject update, qint32 seq);
+
+    //-1 is already applied, 0 is next in line, 1 has to wait
+    qint32 position(qint64 key, const Held &held) const;
+    void apply(qint64 key, const Held &held);
+    void hold(qint64 key, const Held &held);
+    void drain(qint64 key);
+};
+
+#endif // UPDATESEQUENCER_H
@@ -0,0 +1,399 @@
+#include "updatessync.h"
+
+#include <QCoreApplication>
+#include <QSettings>
+#include "tlschema.h"
+#include "messageutil.h"
+#include "tracer.h"
+
+#define SAVE_DELAY 2000
+//Channels are not covered by updates.getDifference, only the recently active ones are caught up
+#define MAX_RECENT_CHANNELS 50
+#define MAX_CHANNELS_ON_SYNC 10
+#define CHANNEL_DIFFERENCE_LIMIT 100
+
+UpdatesSync::UpdatesSync(QObject *parent)
+    : QObject(parent)
+    , m_client(nullptr)
+    , m_userId(0)
+    , m_sequencer(new UpdateSequencer(this))
+    , m_qts(0)
+    , m_date(0)
+    , m_recentChannels()
+    , m_stateRequestId(0)
+    , m_differenceRequestId(0)
+    , m_channelRequests()
+    , m_saveTimer()
+{
+    m_saveTimer.setSingleShot(true);
+    m_saveTimer.setInterval(SAVE_DELAY);
+    connect(&m_saveTimer, SIGNAL(timeout()), this, SLOT(saveState()));
+    connect(m_sequencer, SIGNAL(gotUpdate(TgObject,TgLongVariant,TgList,TgList,qint32,qint32,qint32)), this, SIGNAL(gotUpdate(TgObject,TgLongVariant,TgList,TgList,qint32,qint32,qint32)));
+    connect(m_sequencer, SIGNAL(gapDetected(qint64)), this, SLOT(gapDetected(qint64)));
+}
+
+UpdatesSync::~UpdatesSync()
+{
+    if (m_saveTimer.isActive()) {
+        saveState();
+    }
+}
+
+void UpdatesSync::setClient(QObject *client)
+{
+    TgClient* tclient = dynamic_cast<TgClient*>(client);
+    if (!tclient) {
+        return;
+    }
+
+    if (m_client) {
+        m_client->disconnect(this);
+    }
+
+    m_client = tclient;
+    m_userId = 0;
+
+    connect(m_client, SIGNAL(authorized(TgLongVariant)), this, SLOT(authorized(TgLongVariant)));
+    connect(m_client, SIGNAL(gotUpdate(TgObject,TgLongVariant,TgList,TgList,qint32,qint32,qint32)), this, SLOT(trackUpdate(TgObject,TgLongVariant,TgList,TgList,qint32,qint32,qint32)));
+    connect(m_client, SIGNAL(updatesStateResponse(TgObject,TgLongVariant)), this, SLOT(updatesStateResponse(TgObject,TgLongVariant)));
+    connect(m_client, SIGNAL(updatesDifferenceResponse(TgObject,TgLongVariant)), this, SLOT(updatesDifferenceResponse(TgObject,TgLongVariant)));
+    connect(m_client, SIGNAL(updatesChannelDifferenceResponse(TgObject,TgLongVariant)), this, SLOT(updatesChannelDifferenceResponse(TgObject,TgLongVariant)));
+}
+
+QObject* UpdatesSync::client() const
+{
+    return m_client;
+}
+
+bool UpdatesSync::syncing() const
+{
+    return m_differenceRequestId.toLongLong() != 0 || !m_channelRequests.isEmpty();
+}
+
+void UpdatesSync::readState()
+{
+    m_sequencer->reset();
+    m_qts = m_date = 0;
+    m_recentChannels.clear();
+
+    QSettings settings(QSettings::IniFormat, QSettings::UserScope, QCoreApplication::organizationName(), QCoreApplication::applicationName() + "_cache");
+    TgObject state = settings.value("UpdatesState").toMap();
+
+    //State of another account is useless
+    if (state["userId"].toLongLong() != m_userId.toLongLong()) {
+        return;
+    }
+
+    m_sequencer->setState(state["pts"].toInt(), state["seq"].toInt());
+    m_qts = state["qts"].toInt();
+    m_date = state["date"].toInt();
+
+    TgList channels = state["channels"].toList();
+    for (qint32 i = 0; i < channels.size(); ++i) {
+        TgObject channel = channels[i].toMap();
+        qint64 channelId = channel["id"].toLongLong();
+
+        m_sequencer->setChannelPts(channelId, channel["pts"].toInt());
+        m_recentChannels.append(channelId);
+    }
+}
+
+void UpdatesSync::saveState()
+{
+    m_saveTimer.stop();
+
+    if (m_userId.toLongLong() == 0 || m_sequencer->pts() == 0) {
+        return;
+    }
+
+    TgObject state;
+    state["userId"] = m_userId.toLongLong();
+    state["pts"] = m_sequencer->pts();
+    state["qts"] = m_qts;
+    state["seq"] = m_sequencer->seq();
+    state["date"] = m_date;
+
+    TgList channels;
+    for (qint32 i = 0; i < m_recentChannels.size(); ++i) {
+        TgObject channel;
+        channel["id"] = m_recentChannels[i];
+        channel["pts"] = m_sequencer->channelPts(m_recentChannels[i]);
+        channels << channel;
+    }
+    state["channels"] = channels;
+
+    QSettings settings(QSettings::IniFormat, QSettings::UserScope, QCoreApplication::organizationName(), QCoreApplication::applicationName() + "_cache");
+    settings.setValue("UpdatesState", state);
+}
+
+void UpdatesSync::scheduleSave()
+{
+    if (!m_saveTimer.isActive()) {
+        m_saveTimer.start();
+    }
+}
+
+void UpdatesSync::authorized(TgLongVariant userId)
+{
+    if (m_userId != userId) {
+        m_userId = userId;
+        m_stateRequestId = 0;
+        m_differenceRequestId = 0;
+        m_channelRequests.clear();
+        readState();
+        emit syncingChanged();
+    }
+
+    //Nothing to catch up from: the models load from scratch anyway, just remember where we are
+    if (m_sequencer->pts() == 0) {
+        if (m_stateRequestId.toLongLong() == 0) {
+            m_stateRequestId = m_client->updatesGetState();
+            TRACE_REQUEST_ISSUED("updates.getState", m_stateRequestId.toLongLong());
+        }
+        return;
+    }
+
+    sync();
+
+    for (qint32 i = 0; i < m_recentChannels.size() && i < MAX_CHANNELS_ON_SYNC; ++i) {
+        syncChannel(m_recentChannels[i]);
+    }
+}
+
+void UpdatesSync::sync()
+{
+    if (!m_client || !m_client->isAuthorized() || m_sequencer->pts() == 0 || m_differenceRequestId.toLongLong() != 0) {
+        return;
+    }
+
+    m_differenceRequestId = m_client->updatesGetDifference(m_sequencer->pts(), m_date, m_qts);
+    TRACE_REQUEST_ISSUED("updates.getDifference", m_differenceRequestId.toLongLong());
+    emit syncingChanged();
+}
+
+void UpdatesSync::syncChannel(qint64 channelId)
+{
+    if (!m_client || !m_client->isAuthorized() || m_channelRequests.values().contains(channelId)) {
+        return;
+    }
+
+    TgObject channel = inputChannel(channelId);
+    if (channel.isEmpty()) {
+        return;
+    }
+
+    //Dialogs carry the channel pts, use it for channels without tracked updates yet
+    qint32 pts = m_sequencer->hasChannel(channelId) ? m_sequencer->channelPts(channelId) : dialogPts(channelId);
+    if (pts == 0) {
+        return;
+    }
+
+    TgObject filter;
+    ID_PROPERTY(filter) = TLType::ChannelMessagesFilterEmpty;
+
+    qint64 requestId = m_client->updatesGetChannelDifference(channel, filter, pts, CHANNEL_DIFFERENCE_LIMIT).toLongLong();
+    TRACE_REQUEST_ISSUED("updates.getChannelDifference", requestId);
+    m_channelRequests.insert(requestId, channelId);
+    emit syncingChanged();
+}
+
+void UpdatesSync::trackUpdate(TgObject update, TgLongVariant messageId, TgList users, TgList chats, qint32 date, qint32 seq, qint32 seqStart)
+{
+    if (ID(update) == TLType::UpdateChannelTooLong) {
+        syncChannel(update["channel_id"].toLongLong());
+        return;
+    }
+
+    qint64 channelId = UpdateSequencer::channelId(update);
+    if (channelId != 0 && update.contains("pts")) {
+        //Continue from the dialog pts, so the very first update can already reveal a gap
+        if (!m_sequencer->hasChannel(channelId)) {
+            qint32 pts = dialogPts(channelId);
+            if (pts != 0) {
+                m_sequencer->setChannelPts(channelId, pts);
+            }
+        }
+        touchChannel(channelId);
+    }
+
+    if (update.contains("qts")) {
+        m_qts = qMax(m_qts, update["qts"].toInt());
+    }
+    m_date = qMax(m_date, date);
+
+    m_sequencer->push(update, messageId, users, chats, date, seq, seqStart);
+    scheduleSave();
+}
+
+void UpdatesSync::gapDetected(qint64 channelId)
+{
+    if (channelId == 0) {
+        sync();
+    } else {
+        syncChannel(channelId);
+    }
+}
+
+TgObject UpdatesSync::stats() const
+{
+    return m_sequencer->stats();
+}
+
+void UpdatesSync::touchChannel(qint64 channelId)
+{
+    m_recentChannels.removeOne(channelId);
+    m_recentChannels.prepend(channelId);
+
+    while (m_recentChannels.size() > MAX_RECENT_CHANNELS) {
+        m_sequencer->removeChannel(m_recentChannels.takeLast());
+    }
+}
+
+void UpdatesSync::applyState(TgObject state)
+{
+    m_qts = state["qts"].toInt();
+    m_date = state["date"].toInt();
+    m_sequencer->setState(state["pts"].toInt(), state["seq"].toInt());
+
+    scheduleSave();
+}
+
+void UpdatesSync::applyDifference(TgList messages, TgList updates, TgList users, TgList chats)
+{
+    TRACE_SPAN_ARG("UpdatesSync::applyDifference", "messages", messages.size());
+
+    for (qint32 i = 0; i < messages.size(); ++i) {
+        TgObject message = messages[i].toMap();
+        if (ID(message) == TLType::MessageEmpty) {
+            continue;
+        }
+
+        TgObject update;
+        ID_PROPERTY(update) = TgClient::isChannel(message["peer_id"].toMap()) ? TLType::UpdateNewChannelMessage : TLType::UpdateNewMessage;
+        update["message"] = message;
+
+        emit gotUpdate(update, 0, users, chats, m_date, 0, 0);
+    }
+
+    for (qint32 i = 0; i < updates.size(); ++i) {
+        TgObject update = updates[i].toMap();
+
+        if (ID(update) == TLType::UpdateChannelTooLong) {
+            syncChannel(update["channel_id"].toLongLong());
+            continue;
+        }
+
+        emit gotUpdate(update, 0, users, chats, m_date, 0, 0);
+    }
+}
+
+void UpdatesSync::updatesStateResponse(TgObject data, TgLongVariant messageId)
+{
+    if (m_stateRequestId != messageId) {
+        return;
+    }
+
+    TRACE_REQUEST_FINISHED("updates.getState", messageId.toLongLong());
+    m_stateRequestId = 0;
+
+    applyState(data);
+}
+
+void UpdatesSync::updatesDifferenceResponse(TgObject data, TgLongVariant messageId)
+{
+    if (m_differenceRequestId != messageId) {
+        return;
+    }
+
+    TRACE_REQUEST_FINISHED("updates.getDifference", messageId.toLongLong());
+    m_differenceRequestId = 0;
+
+    switch (ID(data)) {
+    case TLType::UpdatesDifferenceEmpty:
+        m_date = data["date"].toInt();
+        m_sequencer->setState(m_sequencer->pts(), data["seq"].toInt());
+        scheduleSave();
+        break;
+    case TLType::UpdatesDifference:
+        //Replayed before the new state is applied, setState() releases held live
+        //updates which are newer than everything in the difference
+        applyDifference(data["new_messages"].toList(), data["other_updates"].toList(), data["users"].toList(), data["chats"].toList());
+        applyState(data["state"].toMap());
+        break;
+    case TLType::UpdatesDifferenceSlice:
+        //More to come, continue from the intermediate state
+        applyDifference(data["new_messages"].toList(), data["other_updates"].toList(), data["users"].toList(), data["chats"].toList());
+        applyState(data["intermediate_state"].toMap());
+        sync();
+        break;
+    case TLType::UpdatesDifferenceTooLong:
+        m_sequencer->setState(data["pts"].toInt(), m_sequencer->seq());
+        scheduleSave();
+        emit resyncRequired();
+        break;
+    }
+
+    emit syncingChanged();
+}
+
+void UpdatesSync::updatesChannelDifferenceResponse(TgObject data, TgLongVariant messageId)
+{
+    qint64 channelId = m_channelRequests.take(messageId.toLongLong());
+    if (channelId == 0) {
+        return;
+    }
+
+    TRACE_REQUEST_FINISHED("updates.getChannelDifference", messageId.toLongLong());
+
+    switch (ID(data)) {
+    case TLType::UpdatesChannelDifferenceEmpty:
+        m_sequencer->setChannelPts(channelId, data["pts"].toInt());
+        break;
+    case TLType::UpdatesChannelDifference:
+        applyDifference(data["new_messages"].toList(), data["other_updates"].toList(), data["users"].toList(), data["chats"].toList());
+        m_sequencer->setChannelPts(channelId, data["pts"].toInt());
+
+        if (!data["final"].toBool()) {
+            syncChannel(channelId);
+        }
+        break;
+    case TLType::UpdatesChannelDifferenceTooLong:
+        m_sequencer->setChannelPts(channelId, data["dialog"].toMap()["pts"].toInt());
+        emit resyncRequired();
+        break;
+    }
+
+    scheduleSave();
+    emit syncingChanged();
+}
+
+qint32 UpdatesSync::dialogPts(qint64 channelId)
+{
+    return registeredPeer(channelHandle(channelId))["pts"].toInt();
+}
+
+TgObject UpdatesSync::inputChannel(qint64 channelId)
+{
+    TgObject channel = registeredPeer(channelHandle(channelId));
+
+    if (channel.isEmpty()) {
+        TgList chats = globalChats();
+        for (qint32 i = 0; i < chats.size(); ++i) {
+            TgObject chat = chats[i].toMap();
+            if (TgClient::isChannel(chat) && chat["id"].toLongLong() == channelId) {
+                channel = chat;
+                break;
+            }
+        }
+    }
+
+    if (channel.isEmpty()) {
+        return TgObject();
+    }
+
+    TgObject input;
+    ID_PROPERTY(input) = TLType::InputChannel;
+    input["channel_id"] = channelId;
+    input["access_hash"] = channel["access_hash"];
+    return input;
+}
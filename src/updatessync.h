@@ -0,0 +1,82 @@
+#ifndef UPDATESSYNC_H
+#define UPDATESSYNC_H
+
+#include <QObject>
+#include <QHash>
+#include <QTimer>
+#include "tgclient.h"
+#include "updatesequencer.h"
+
+//Keeps the update state (pts, qts, seq, date and per-channel pts) persisted across
+//sessions and catches up with updates.getDifference/updates.getChannelDifference
+//after a reconnect or resume. Missed updates are replayed through gotUpdate(), so
+//the models patch their rows in place instead of reloading everything.
+//Live updates go through an UpdateSequencer first, a gap it finds is repaired
+//with a difference as well.
+class UpdatesSync : public QObject
+{
+    Q_OBJECT
+    Q_PROPERTY(QObject* client READ client WRITE setClient)
+    Q_PROPERTY(bool syncing READ syncing NOTIFY syncingChanged)
+
+public:
+    explicit UpdatesSync(QObject *parent = 0);
+    virtual ~UpdatesSync();
+
+    void setClient(QObject *client);
+    QObject* client() const;
+
+    bool syncing() const;
+
+    void readState();
+    void saveState();
+
+signals:
+    //Same signature as TgClient::gotUpdate, so models connect both the same way
+    void gotUpdate(TgObject update, TgLongVariant messageId, TgList users, TgList chats, qint32 date, qint32 seq, qint32 seqStart);
+    //The gap is too large for a difference, models have to be reloaded
+    void resyncRequired();
+    void syncingChanged();
+
+public slots:
+    void authorized(TgLongVariant userId);
+    void trackUpdate(TgObject update, TgLongVariant messageId, TgList users, TgList chats, qint32 date, qint32 seq, qint32 seqStart);
+
+    void sync();
+    void syncChannel(qint64 channelId);
+
+    void updatesStateResponse(TgObject data, TgLongVariant messageId);
+    void updatesDifferenceResponse(TgObject data, TgLongVariant messageId);
+    void updatesChannelDifferenceResponse(TgObject data, TgLongVariant messageId);
+
+    void gapDetected(qint64 channelId);
+    TgObject stats() const;
+
+private:
+    TgClient* m_client;
+    TgLongVariant m_userId;
+
+    //Owns pts, seq and the channel pts
+    UpdateSequencer* m_sequencer;
+    qint32 m_qts;
+    qint32 m_date;
+
+    //Most recently updated channels first, synced on reconnect
+    QList<qint64> m_recentChannels;
+
+    TgLongVariant m_stateRequestId;
+    TgLongVariant m_differenceRequestId;
+    QHash<qint64, qint64> m_channelRequests;
+
+    QTimer m_saveTimer;
+
+    void applyState(TgObject state);
+    void applyDifference(TgList messages, TgList updates, TgList users, TgList chats);
+    void touchChannel(qint64 channelId);
+    void scheduleSave();
+
+    static qint32 dialogPts(qint64 channelId);
+    static TgObject inputChannel(qint64 channelId);
+};
+
+#endif // UPDATESSYNC_H